@@ -5,6 +5,9 @@
 
 /* All calls return >= 0 on success or -1 on failure. */
 
+/* Nonzero if the syscall stubs use sysenter instead of int $0x80. */
+extern uint8_t ece391_has_sysenter;
+
 /*  
  * Note that the system call for halt will have to make sure that only
  * the low byte of EBX (the status argument) is returned to the calling
@@ -20,9 +20,27 @@ extern void mp1_rtc_tasklet(unsigned long trash);
 
 static struct mp1_blink_struct blink_array[80*25];
 
+/*
+ * Waits out n RTC ticks, running the tasklet once per tick. A read reports
+ * every tick since the last one, so when we fall behind under load the
+ * tasklet catches up instead of the animation drifting.
+ */
+static void wait_ticks(int rtc_fd, int n)
+{
+    uint32_t ticks;
+    int i = 0;
+
+    while (i < n) {
+        ticks = 1;
+        ece391_read(rtc_fd, &ticks, 4);
+        for (; ticks > 0 && i < n; ticks--, i++)
+            mp1_rtc_tasklet(0);
+    }
+}
+
 int main(void)
 {
-    int rtc_fd, ret_val, i, garbage;
+    int rtc_fd, ret_val;
     struct mp1_blink_struct blink_struct;
 
     ece391_memset(blink_array, 0, sizeof(struct mp1_blink_struct)*80*25);
@@ -38,10 +56,7 @@ int main(void)
     ret_val = 32;
     ret_val = ece391_write(rtc_fd, &ret_val, 4);
 
-    for(i=0; i<WAIT; i++) {
-        ece391_read(rtc_fd, &garbage, 4);
-        mp1_rtc_tasklet(garbage);
-    }
+    wait_ticks(rtc_fd, WAIT);
 
     blink_struct.on_char = 'I';
     blink_struct.off_char = 'M';
@@ -51,25 +66,16 @@ int main(void)
 
     mp1_ioctl((unsigned long)&blink_struct, RTC_ADD);
 
-    for(i=0; i<WAIT; i++) {
-        ece391_read(rtc_fd, &garbage, 4);
-        mp1_rtc_tasklet(garbage);
-    }
+    wait_ticks(rtc_fd, WAIT);
 
     mp1_ioctl((40 << 16 | (6*80+60)), RTC_SYNC);
 
-    for(i=0; i<WAIT; i++) {
-        ece391_read(rtc_fd, &garbage, 4);
-        mp1_rtc_tasklet(garbage);
-    }
+    wait_ticks(rtc_fd, WAIT);
 
     blink_struct.location = 60;
-    mp1_ioctl(i, RTC_REMOVE);
+    mp1_ioctl(WAIT, RTC_REMOVE);
 
-    for(i=0; i<80*25; i++) {
-        ece391_read(rtc_fd, &garbage, 4);
-        mp1_rtc_tasklet(garbage);
-    }
+    wait_ticks(rtc_fd, 80*25);
 
     ece391_close(rtc_fd);
 
@@ -0,0 +1,367 @@
+// apic.c
+// local APIC and IO-APIC registers. The local APIC of each CPU sends IPIs
+// (to start the other CPUs), takes end-of-interrupt and has a timer that can
+// replace the PIT; the IO-APIC can take over delivering the ISA IRQs from the
+// 8259s.
+
+#include "apic.h"
+#include "i8259.h"
+#include "lib.h"
+
+// CONSTANTS
+// local APIC registers (offsets from lapic_base)
+#define LAPIC_ID        0x020
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0
+#define LAPIC_ESR       0x280
+#define LAPIC_ICR_LO    0x300
+#define LAPIC_ICR_HI    0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_TIMER_ICR 0x380      // initial count
+#define LAPIC_TIMER_CCR 0x390      // current count
+#define LAPIC_TIMER_DCR 0x3E0      // divide configuration
+
+#define SVR_ENABLE      0x00000100
+#define LVT_MASKED      0x00010000
+#define LVT_EXTINT      0x00000700
+#define LVT_NMI         0x00000400
+#define ICR_PENDING     0x00001000
+#define LVT_PERIODIC    0x00020000
+#define IPI_TIMEOUT     100000     // polls of the delivery status bit
+#define TIMER_DIV_16    0x3
+#define APIC_BASE_MSR   0x1B
+#define APIC_BASE_ENABLE 0x800
+#define CPUID_APIC      0x200      // leaf 1 edx
+
+// PIT channel 2, used once to calibrate the timer (see clock.c)
+#define PIT_CH2_DATA    0x42
+#define PIT_COMMAND     0x43
+#define PIT_CH2_GATE    0x61
+#define PIT_CH2_MODE    0xB0
+#define PIT_HZ          1193182
+#define CALIBRATE_MS    10
+#define CALIBRATE_COUNT (PIT_HZ / (1000 / CALIBRATE_MS))
+
+// IO-APIC registers, reached through IOREGSEL/IOWIN
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WIN      0x10
+#define IOAPIC_VER      0x01
+#define IOAPIC_REDTBL   0x10       // two registers per pin
+#define REDTBL_MASKED   0x00010000
+#define REDTBL_LOW      0x00002000 // active low polarity
+#define REDTBL_LEVEL    0x00008000 // level triggered
+#define MP_POLARITY_LOW 0x0003     // MP table interrupt entry flags
+#define MP_TRIGGER_LEVEL 0x000C
+
+// GLOBAL VARIABLES
+uint32_t lapic_base = LAPIC_DEFAULT_BASE;
+uint8_t lapic_enabled = 0;
+uint32_t lapic_timer_khz = 0;
+uint32_t ioapic_base = 0;
+uint8_t ioapic_isa_pin[NUM_ISA_IRQS] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+uint16_t ioapic_isa_flags[NUM_ISA_IRQS];
+static uint32_t ioapic_pins;
+
+// FUNCTION DECLARATIONS
+int32_t lapic_detect(void);
+void lapic_init(uint8_t bsp);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+int32_t lapic_send_ipi(uint32_t apic_id, uint32_t icr);
+int32_t lapic_timer_init(void);
+void lapic_timer_oneshot(uint32_t count);
+void lapic_timer_periodic(uint32_t count);
+void lapic_timer_stop(void);
+void ioapic_init(uint32_t dest_apic_id);
+void ioapic_set_mask(uint8_t irq_num, uint8_t masked);
+int32_t ioapic_masked(uint8_t irq_num);
+static inline uint32_t lapic_read(uint32_t reg);
+static inline void lapic_write(uint32_t reg, uint32_t val);
+static uint32_t ioapic_read(uint32_t reg);
+static void ioapic_write(uint32_t reg, uint32_t val);
+static int32_t ioapic_irq_has_pin(uint32_t irq);
+
+// GLOBAL FUNCTIONS
+/*
+lapic_detect
+    DESCRIPTION: checks that the CPU has a local APIC and finds its registers
+    INPUTS: none
+    OUTPUTS: sets lapic_base
+    RETURNS: 0 if there is a usable local APIC, -1 if not
+*/
+int32_t lapic_detect(void) {
+    uint32_t regs[4];
+    uint32_t base;
+
+    cpuid(1, regs);
+    if (!(regs[3] & CPUID_APIC)) {
+        return -1;
+    }
+
+    base = (uint32_t) rdmsr(APIC_BASE_MSR);
+    if (!(base & APIC_BASE_ENABLE) || (base & ~0x3FFFFF) != APIC_REGION) {
+        return -1; // disabled by the firmware, or somewhere we don't map
+    }
+    lapic_base = base & ~0xFFF;
+    return 0;
+}
+
+/*
+lapic_init
+    DESCRIPTION: software-enables the local APIC of the running CPU. The boot
+                 CPU keeps taking 8259 interrupts through LINT0 (virtual wire)
+                 until the IO-APIC takes over.
+    INPUTS: bsp - 1 on the boot CPU
+    OUTPUTS: none
+    RETURNS: none
+*/
+void lapic_init(uint8_t bsp) {
+    lapic_write(LAPIC_SVR, SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_LVT_LINT0, bsp ? LVT_EXTINT : LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LVT_NMI);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_DCR, TIMER_DIV_16); // same on every CPU, lapic_timer_khz holds for all
+    lapic_write(LAPIC_ESR, 0);
+    lapic_eoi();
+    if (bsp) {
+        lapic_enabled = 1;
+    }
+}
+
+/*
+lapic_id
+    DESCRIPTION: APIC ID of the running CPU
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: the ID
+*/
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+/*
+lapic_eoi
+    DESCRIPTION: signals end of interrupt to the running CPU's local APIC
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+*/
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/*
+lapic_send_ipi
+    DESCRIPTION: sends an interprocessor interrupt and waits for it to go out
+    INPUTS: apic_id - destination CPU
+            icr - low half of the interrupt command (ICR_INIT, ICR_STARTUP | page, ...)
+    OUTPUTS: none
+    RETURNS: 0 for success, -1 if it was never delivered
+*/
+int32_t lapic_send_ipi(uint32_t apic_id, uint32_t icr) {
+    int32_t i;
+
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, icr);
+    for (i = 0; i < IPI_TIMEOUT; i++) {
+        if (!(lapic_read(LAPIC_ICR_LO) & ICR_PENDING)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+lapic_timer_init
+    DESCRIPTION: measures the local APIC timer rate by timing a 10 ms one-shot
+                 on PIT channel 2, the same way clock_init measures the TSC
+    INPUTS: none
+    OUTPUTS: sets lapic_timer_khz
+    RETURNS: 0 for success, -1 if there is no local APIC to use
+    NOTES: interrupts should be off, uses channel 2 and the speaker gate
+*/
+int32_t lapic_timer_init(void) {
+    uint32_t gate;
+    uint32_t elapsed;
+
+    if (!lapic_enabled) {
+        return -1;
+    }
+
+    lapic_write(LAPIC_TIMER_DCR, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VECTOR);
+
+    gate = inb(PIT_CH2_GATE);
+    outb((gate & ~0x02) | 0x01, PIT_CH2_GATE);
+    outb(PIT_CH2_MODE, PIT_COMMAND);
+    outb(CALIBRATE_COUNT & 0xFF, PIT_CH2_DATA);
+    outb((CALIBRATE_COUNT >> 8) & 0xFF, PIT_CH2_DATA);
+
+    lapic_write(LAPIC_TIMER_ICR, 0xFFFFFFFF);
+    while (!(inb(PIT_CH2_GATE) & 0x20));
+    elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CCR);
+    lapic_write(LAPIC_TIMER_ICR, 0);
+
+    outb(gate, PIT_CH2_GATE);
+
+    lapic_timer_khz = elapsed / CALIBRATE_MS;
+    if (lapic_timer_khz == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+lapic_timer_oneshot
+    DESCRIPTION: arms the local APIC timer to interrupt once on
+                 LAPIC_TIMER_VECTOR, replacing whatever was armed
+    INPUTS: count - timer counts (lapic_timer_khz per ms) until it fires, > 0
+    OUTPUTS: none
+    RETURNS: none
+*/
+void lapic_timer_oneshot(uint32_t count) {
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_ICR, count);
+}
+
+/*
+lapic_timer_periodic
+    DESCRIPTION: makes the local APIC timer interrupt every count timer counts
+    INPUTS: count - period in timer counts, > 0
+    OUTPUTS: none
+    RETURNS: none
+*/
+void lapic_timer_periodic(uint32_t count) {
+    lapic_write(LAPIC_LVT_TIMER, LVT_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_ICR, count);
+}
+
+/*
+lapic_timer_stop
+    DESCRIPTION: stops the local APIC timer
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+*/
+void lapic_timer_stop(void) {
+    lapic_write(LAPIC_TIMER_ICR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VECTOR);
+}
+
+/*
+ioapic_init
+    DESCRIPTION: points every ISA IRQ at its usual vector on one CPU, all masked
+    INPUTS: dest_apic_id - CPU that takes the interrupts
+    OUTPUTS: none
+    RETURNS: none
+*/
+void ioapic_init(uint32_t dest_apic_id) {
+    uint32_t pin, irq, low;
+
+    ioapic_pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+    for (pin = 0; pin < ioapic_pins; pin++) {
+        ioapic_write(IOAPIC_REDTBL + 2 * pin, REDTBL_MASKED);
+        ioapic_write(IOAPIC_REDTBL + 2 * pin + 1, 0);
+    }
+
+    for (irq = 0; irq < NUM_ISA_IRQS; irq++) {
+        if (!ioapic_irq_has_pin(irq)) {
+            continue;
+        }
+        low = REDTBL_MASKED | (IRQ_VECTOR_BASE + irq);
+        if ((ioapic_isa_flags[irq] & MP_POLARITY_LOW) == MP_POLARITY_LOW) {
+            low |= REDTBL_LOW;
+        }
+        if ((ioapic_isa_flags[irq] & MP_TRIGGER_LEVEL) == MP_TRIGGER_LEVEL) {
+            low |= REDTBL_LEVEL;
+        }
+        ioapic_write(IOAPIC_REDTBL + 2 * ioapic_isa_pin[irq] + 1, dest_apic_id << 24);
+        ioapic_write(IOAPIC_REDTBL + 2 * ioapic_isa_pin[irq], low);
+    }
+}
+
+/*
+ioapic_set_mask
+    DESCRIPTION: masks or unmasks an ISA IRQ at the IO-APIC
+    INPUTS: irq_num - 0-15
+            masked - 1 to mask
+    OUTPUTS: none
+    RETURNS: none
+*/
+void ioapic_set_mask(uint8_t irq_num, uint8_t masked) {
+    uint32_t reg = IOAPIC_REDTBL + 2 * ioapic_isa_pin[irq_num];
+    uint32_t low;
+
+    if (!ioapic_irq_has_pin(irq_num)) {
+        return;
+    }
+    low = ioapic_read(reg);
+
+    if (masked) {
+        low |= REDTBL_MASKED;
+    } else {
+        low &= ~REDTBL_MASKED;
+    }
+    ioapic_write(reg, low);
+}
+
+/*
+ioapic_masked
+    DESCRIPTION: checks whether an ISA IRQ is masked at the IO-APIC
+    INPUTS: irq_num - 0-15
+    OUTPUTS: none
+    RETURNS: 1 if masked or not wired to a pin, 0 otherwise
+*/
+int32_t ioapic_masked(uint8_t irq_num) {
+    if (!ioapic_irq_has_pin(irq_num)) {
+        return 1;
+    }
+    return (ioapic_read(IOAPIC_REDTBL + 2 * ioapic_isa_pin[irq_num]) & REDTBL_MASKED) ? 1 : 0;
+}
+
+// LOCAL FUNCTIONS
+static inline uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(lapic_base + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    *(volatile uint32_t*)(lapic_base + reg) = val;
+}
+
+static uint32_t ioapic_read(uint32_t reg) {
+    *(volatile uint32_t*)(ioapic_base + IOAPIC_REGSEL) = reg;
+    return *(volatile uint32_t*)(ioapic_base + IOAPIC_WIN);
+}
+
+static void ioapic_write(uint32_t reg, uint32_t val) {
+    *(volatile uint32_t*)(ioapic_base + IOAPIC_REGSEL) = reg;
+    *(volatile uint32_t*)(ioapic_base + IOAPIC_WIN) = val;
+}
+
+/*
+ioapic_irq_has_pin
+    DESCRIPTION: says whether an ISA IRQ owns a pin of its own. IRQ2 is the 8259 cascade and
+                 never reaches the IO-APIC, and an IRQ left on its default pin loses it when
+                 another IRQ's override points there (SeaBIOS sends IRQ0 to pin 2).
+    INPUTS: irq - 0-15
+    OUTPUTS: none
+    RETURNS: 1 if the IRQ can be programmed, 0 if not
+*/
+static int32_t ioapic_irq_has_pin(uint32_t irq) {
+    uint32_t other;
+
+    if (irq == SLAVE_IRQ_NUM || ioapic_isa_pin[irq] >= ioapic_pins) {
+        return 0;
+    }
+    if (ioapic_isa_pin[irq] != irq) {
+        return 1; // overrides always win
+    }
+    for (other = 0; other < NUM_ISA_IRQS; other++) {
+        if (other != irq && ioapic_isa_pin[other] == irq) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,42 @@
+// apic.h
+
+#ifndef APIC_H
+#define APIC_H
+
+#include "types.h"
+
+#define APIC_REGION          0xFEC00000 // 4 MB window holding the IO-APIC and local APIC registers
+#define LAPIC_DEFAULT_BASE   0xFEE00000
+#define IOAPIC_DEFAULT_BASE  0xFEC00000
+#define APIC_SPURIOUS_VECTOR 0xFF
+#define IRQ_VECTOR_BASE      0x20       // IRQ n arrives on vector 0x20 + n, same as with the 8259s
+#define LAPIC_TIMER_VECTOR   0x30
+#define NUM_ISA_IRQS         16
+
+// interrupt command register delivery modes
+#define ICR_FIXED            0x00004000 // fixed, level assert, low byte is the vector
+#define ICR_INIT             0x00004500 // INIT, level assert
+#define ICR_STARTUP          0x00004600 // start-up IPI, low byte is the start page
+
+extern uint32_t lapic_base;
+extern uint8_t lapic_enabled;           // 1 once the boot CPU's local APIC is on
+extern uint32_t lapic_timer_khz;        // local APIC timer counts per millisecond
+extern uint32_t ioapic_base;            // 0 if there is no IO-APIC
+extern uint8_t ioapic_isa_pin[NUM_ISA_IRQS];
+extern uint16_t ioapic_isa_flags[NUM_ISA_IRQS]; // MP table polarity/trigger bits, 0 for ISA defaults
+
+// GLOBAL FUNCTIONS
+extern int32_t lapic_detect(void);
+extern void lapic_init(uint8_t bsp);
+extern uint32_t lapic_id(void);
+extern void lapic_eoi(void);
+extern int32_t lapic_send_ipi(uint32_t apic_id, uint32_t icr);
+extern int32_t lapic_timer_init(void);
+extern void lapic_timer_oneshot(uint32_t count);
+extern void lapic_timer_periodic(uint32_t count);
+extern void lapic_timer_stop(void);
+extern void ioapic_init(uint32_t dest_apic_id);
+extern void ioapic_set_mask(uint8_t irq_num, uint8_t masked);
+extern int32_t ioapic_masked(uint8_t irq_num);
+
+#endif
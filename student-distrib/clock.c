@@ -0,0 +1,175 @@
+// clock.c
+// monotonic nanosecond clock read from the TSC, which is calibrated against PIT
+// channel 2 at boot, and the clock syscalls
+
+#include "clock.h"
+#include "lib.h"
+#include "syscalls.h"
+#include "paging.h"
+#include "pit.h"
+#include "timer.h"
+
+// CONSTANTS
+#define PIT_CH2_DATA    0x42
+#define PIT_COMMAND     0x43
+#define PIT_CH2_GATE    0x61       // bit 0: channel 2 gate, bit 1: speaker, bit 5: channel 2 output
+#define PIT_CH2_MODE    0xB0       // channel 2, lo/hi access, mode 0, 16-bit binary
+#define PIT_HZ          1193182
+#define CALIBRATE_MS    10
+#define CALIBRATE_COUNT (PIT_HZ / (1000 / CALIBRATE_MS))
+
+// GLOBAL VARIABLES
+uint32_t tsc_khz = 0;              // TSC cycles per millisecond
+uint32_t clock_mult = 0;           // nanoseconds per cycle, fixed point with CLOCK_SHIFT fraction bits
+uint64_t tsc_base = 0;             // TSC at boot, the clock counts from here
+
+// FUNCTION DECLARATIONS
+void clock_init(void);
+uint64_t clock_ns(void);
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+int32_t clock_gettime(int32_t clock_id, timespec_t* tp);
+int32_t nanosleep(const timespec_t* req);
+
+// GLOBAL FUNCTIONS
+/*
+clock_init
+    DESCRIPTION: measures the TSC rate by timing a 10 ms one-shot on PIT channel 2
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts should be off, uses channel 2 and the speaker gate
+*/
+void clock_init(void) {
+    uint32_t gate;
+    uint64_t start, end;
+
+    // gate channel 2 on with the speaker disconnected
+    gate = inb(PIT_CH2_GATE);
+    outb((gate & ~0x02) | 0x01, PIT_CH2_GATE);
+
+    outb(PIT_CH2_MODE, PIT_COMMAND);
+    outb(CALIBRATE_COUNT & 0xFF, PIT_CH2_DATA);
+    outb((CALIBRATE_COUNT >> 8) & 0xFF, PIT_CH2_DATA);
+
+    // channel 2 output goes high at terminal count
+    start = rdtsc();
+    while (!(inb(PIT_CH2_GATE) & 0x20));
+    end = rdtsc();
+
+    outb(gate, PIT_CH2_GATE);
+
+    tsc_khz = (uint32_t)(end - start) / CALIBRATE_MS;
+    if (tsc_khz == 0) {
+        tsc_khz = 1;
+    }
+    clock_mult = (uint32_t)div64_32((uint64_t)1000000 << CLOCK_SHIFT, tsc_khz, NULL);
+    tsc_base = rdtsc();
+}
+
+/*
+clock_ns
+    DESCRIPTION: reads the monotonic clock
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: nanoseconds since clock_init
+*/
+uint64_t clock_ns(void) {
+    return clock_cycles_to_ns(rdtsc() - tsc_base);
+}
+
+/*
+clock_cycles_to_ns
+    DESCRIPTION: converts a TSC cycle count to nanoseconds
+    INPUTS: cycles - a difference of two rdtsc() readings
+    OUTPUTS: none
+    RETURNS: the time in nanoseconds
+*/
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    uint32_t lo = (uint32_t)cycles;
+    uint32_t hi = (uint32_t)(cycles >> 32);
+
+    // split the multiply so the 64-bit product can't overflow
+    return (((uint64_t)lo * clock_mult) >> CLOCK_SHIFT) + (((uint64_t)hi * clock_mult) << (32 - CLOCK_SHIFT));
+}
+
+/*
+ * clock_gettime
+ *   DESCRIPTION:  reads the monotonic clock into a user timespec
+ *   INPUTS:       clock_id - only CLOCK_MONOTONIC is supported
+ *                 tp - where to store the time
+ *   OUTPUTS:      time since boot
+ *   RETURN VALUE: 0 if successful, -1 if not
+ *   SIDE EFFECTS: none
+ */
+int32_t clock_gettime(int32_t clock_id, timespec_t* tp) {
+    uint64_t now;
+    uint32_t nsec;
+
+    if (clock_id != CLOCK_MONOTONIC || tp == NULL) {
+        return -1;
+    }
+    if (!user_range_ok((uint32_t) tp, sizeof(timespec_t))) {
+        return -1;
+    }
+
+    now = clock_ns();
+    tp->tv_sec = (uint32_t)div64_32(now, NS_PER_SEC, &nsec);
+    tp->tv_nsec = nsec;
+
+    return 0;
+}
+
+/*
+ * nanosleep
+ *   DESCRIPTION:  blocks the calling process for the requested time. The process
+ *                 arms its sleep timer on the timer wheel and the PIT is programmed
+ *                 to go off at the first expiry, so no tick is needed in between.
+ *                 The wakeup is rounded up to the wheel's 1 ms tick.
+ *   INPUTS:       req - how long to sleep
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 0 if successful, -1 if not or if a signal cut the sleep short
+ *   SIDE EFFECTS: context switch
+ */
+int32_t nanosleep(const timespec_t* req) {
+    uint64_t wake;
+    uint32_t expires;
+    ktimer_t* timer = &processes[CPID].sleep_timer;
+
+    if (req == NULL) {
+        return -1;
+    }
+    if (!user_range_ok((uint32_t) req, sizeof(timespec_t))) {
+        return -1;
+    }
+    if (req->tv_nsec >= NS_PER_SEC) {
+        return -1;
+    }
+
+    wake = clock_ns() + (uint64_t)req->tv_sec * NS_PER_SEC + req->tv_nsec;
+
+    expires = (uint32_t)div64_32(wake + TIMER_TICK_NS - 1, TIMER_TICK_NS, NULL);
+
+    cli();
+    timer_setup(timer, timer_wakeup, CPID);
+    do {
+        // the wheel clamps to TIMER_MAX_DELAY, a longer sleep takes several laps
+        timer_add(timer, expires);
+
+        // the new expiry may be sooner than the armed tick
+        pit_update();
+
+        while (timer->pending) {
+            // woken early to run a signal handler
+            if (signal_pending(CPID)) {
+                timer_cancel(timer);
+                sti();
+                return -1;
+            }
+            task_sleep();
+            cli();
+        }
+    } while (timer->expires != expires);
+    sti();
+
+    return 0;
+}
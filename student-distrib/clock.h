@@ -0,0 +1,30 @@
+// clock.h
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "types.h"
+
+#define CLOCK_MONOTONIC 0
+#define NS_PER_SEC      1000000000
+#define CLOCK_SHIFT     24 // ns = (cycles * clock_mult) >> CLOCK_SHIFT
+
+typedef struct {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+} timespec_t;
+
+extern uint32_t tsc_khz;
+extern uint32_t clock_mult;
+extern uint64_t tsc_base;
+
+// GLOBAL FUNCTIONS
+extern void clock_init(void);
+extern uint64_t clock_ns(void);
+extern uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+// System Calls
+extern int32_t clock_gettime(int32_t clock_id, timespec_t* tp);
+extern int32_t nanosleep(const timespec_t* req);
+
+#endif
@@ -192,8 +192,6 @@ fs_copy
 int32_t fs_copy(const int8_t* fname, uint8_t * mem_location) {
 	dentry_t file_dentry;
 	uint32_t inode;
-	int32_t bytes_read;
-	uint8_t buf[bootblock.n_datablocks*FS_BLOCK_SIZE]; //maximum file size - if 1 file used all available datablocks
 
 	if (!fname || !mem_location)
 		return -1; // invalid file name or invalid mem_location
@@ -202,29 +200,38 @@ int32_t fs_copy(const int8_t* fname, uint8_t * mem_location) {
 	if (read_dentry_by_name(fname, &file_dentry))
 		return -1; // function returned -1
 
-	// read file data into buf
+	// read file data straight into place, images can be far bigger than a kernel stack
 	inode = file_dentry.inode;
-	bytes_read = read_data(inode, 0, buf, inodes[inode].length);
-	if (bytes_read == -1)
+	if (read_data(inode, 0, mem_location, inodes[inode].length) == -1)
 		return -1;
 
-	// write the file into physical memory
-	int32_t i;
-	for (i = 0; i < bytes_read; i++) {
-		mem_location[i] = buf[i];
-	}
-
 	return 0;
 }
 
+/*
+fs_size
+    DESCRIPTION: looks up the length of a file
+    INPUTS: file name
+    OUTPUTS: none
+    RETURNS: length in bytes, -1 if there is no such file
+*/
+int32_t fs_size(const int8_t* fname) {
+	dentry_t file_dentry;
+
+	if (!fname || read_dentry_by_name(fname, &file_dentry))
+		return -1;
+
+	return inodes[file_dentry.inode].length;
+}
+
 /*
 fs_open
     DESCRIPTION: opens a file
-    INPUTS: file name
+    INPUTS: file - the new descriptor
     OUTPUTS: none
     RETURNS: 0 on success, -1 on fail
 */
-int32_t fs_open () {
+int32_t fs_open (file_t* file) {
 	return 0;
 }
 
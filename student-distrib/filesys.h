@@ -54,7 +54,7 @@ struct file {
 };
 
 struct fileops {
-    int32_t (*open)();
+    int32_t (*open)(file_t*);
     int32_t (*read)(file_t*, uint8_t *, int32_t);
     int32_t (*write)(file_t*, uint8_t *, int32_t);
     int32_t (*close)(file_t*);
@@ -64,7 +64,8 @@ struct fileops {
 // GLOBAL FUNCTIONS
 extern int32_t fs_init(void* start, void* end);
 extern int32_t fs_copy(const int8_t * fname, uint8_t * mem_location);
-extern int32_t fs_open ();
+extern int32_t fs_size(const int8_t * fname);
+extern int32_t fs_open (file_t* file);
 extern int32_t fs_close(file_t* file);
 extern int32_t fs_read (file_t* file, uint8_t * buf, int32_t nbytes);
 extern int32_t fs_write (file_t* file, uint8_t * buf, int32_t nbytes);
@@ -0,0 +1,162 @@
+// frame.c
+// physical memory for user programs. Everything above the kernel's 4 MB page
+// is split into 4 MB frames: program images take whole frames, and frames
+// that are split up hand out 4 KB pages (user stacks) until all of their
+// pages are back.
+
+#include "frame.h"
+#include "lib.h"
+
+// CONSTANTS
+#define FOUR_MB         0x00400000
+#define PAGE_SIZE       4096
+#define PAGES_PER_FRAME 1024
+
+#define FRAME_FREE  0
+#define FRAME_WHOLE 1 // mapped as one 4 MB page
+#define FRAME_SPLIT 2 // handing out 4 KB pages
+
+// GLOBAL VARIABLES
+static uint8_t frame_state[MAX_FRAMES];
+static uint32_t num_frames;
+static uint32_t page_bits[MAX_FRAMES][PAGES_PER_FRAME / 32]; // pages in use in a split frame
+static uint32_t pages_used[MAX_FRAMES];
+
+// FUNCTION DECLARATIONS
+void frame_init(uint32_t mem_end);
+uint32_t frame_alloc(void);
+void frame_free(uint32_t phys_addr);
+uint32_t page_alloc(void);
+void page_free(uint32_t phys_addr);
+static int32_t take_frame(uint8_t state);
+
+// GLOBAL FUNCTIONS
+/*
+ * frame_init
+ *   DESCRIPTION:  sets up the frames between FRAME_BASE and the end of memory
+ *   INPUTS:       mem_end - first physical address past the end of memory
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void frame_init(uint32_t mem_end) {
+    num_frames = (mem_end > FRAME_BASE) ? (mem_end - FRAME_BASE) / FOUR_MB : 0;
+    if (num_frames > MAX_FRAMES) {
+        num_frames = MAX_FRAMES;
+    }
+}
+
+/*
+ * frame_alloc
+ *   DESCRIPTION:  takes a whole 4 MB frame
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: physical address of the frame, 0 if memory is full
+ *   SIDE EFFECTS: none
+ */
+uint32_t frame_alloc(void) {
+    int32_t i = take_frame(FRAME_WHOLE);
+
+    return (i < 0) ? 0 : FRAME_BASE + i * FOUR_MB;
+}
+
+/*
+ * frame_free
+ *   DESCRIPTION:  gives back a frame from frame_alloc
+ *   INPUTS:       phys_addr - physical address of the frame
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void frame_free(uint32_t phys_addr) {
+    uint32_t i = (phys_addr - FRAME_BASE) / FOUR_MB;
+
+    if (phys_addr >= FRAME_BASE && i < num_frames && frame_state[i] == FRAME_WHOLE) {
+        frame_state[i] = FRAME_FREE;
+    }
+}
+
+/*
+ * page_alloc
+ *   DESCRIPTION:  takes a 4 KB page, splitting a new frame if the split ones
+ *                 are full
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: physical address of the page, 0 if memory is full
+ *   SIDE EFFECTS: none
+ */
+uint32_t page_alloc(void) {
+    uint32_t flags;
+    int32_t i, j;
+
+    cli_and_save(flags);
+    for (i = 0; i < num_frames; i++) {
+        if (frame_state[i] == FRAME_SPLIT && pages_used[i] < PAGES_PER_FRAME) {
+            break;
+        }
+    }
+    if (i == num_frames && (i = take_frame(FRAME_SPLIT)) < 0) {
+        restore_flags(flags);
+        return 0;
+    }
+
+    for (j = 0; page_bits[i][j / 32] & (1 << (j % 32)); j++);
+    page_bits[i][j / 32] |= 1 << (j % 32);
+    pages_used[i]++;
+    restore_flags(flags);
+
+    return FRAME_BASE + i * FOUR_MB + j * PAGE_SIZE;
+}
+
+/*
+ * page_free
+ *   DESCRIPTION:  gives back a page from page_alloc, and its frame once all of
+ *                 the frame's pages are back
+ *   INPUTS:       phys_addr - physical address of the page
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void page_free(uint32_t phys_addr) {
+    uint32_t i = (phys_addr - FRAME_BASE) / FOUR_MB;
+    uint32_t j = (phys_addr % FOUR_MB) / PAGE_SIZE;
+    uint32_t flags;
+
+    if (phys_addr < FRAME_BASE || i >= num_frames) {
+        return;
+    }
+
+    cli_and_save(flags);
+    if (frame_state[i] == FRAME_SPLIT && (page_bits[i][j / 32] & (1 << (j % 32)))) {
+        page_bits[i][j / 32] &= ~(1 << (j % 32));
+        if (--pages_used[i] == 0) {
+            frame_state[i] = FRAME_FREE;
+        }
+    }
+    restore_flags(flags);
+}
+
+// LOCAL FUNCTIONS
+/*
+ * take_frame
+ *   DESCRIPTION:  marks the first free frame as used
+ *   INPUTS:       state - FRAME_WHOLE or FRAME_SPLIT
+ *   OUTPUTS:      none
+ *   RETURN VALUE: index of the frame, -1 if there is none
+ *   SIDE EFFECTS: none
+ */
+static int32_t take_frame(uint8_t state) {
+    uint32_t flags;
+    int32_t i;
+
+    cli_and_save(flags);
+    for (i = 0; i < num_frames && frame_state[i] != FRAME_FREE; i++);
+    if (i == num_frames) {
+        restore_flags(flags);
+        return -1;
+    }
+    frame_state[i] = state;
+    restore_flags(flags);
+
+    return i;
+}
@@ -0,0 +1,18 @@
+// frame.h
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "types.h"
+
+#define FRAME_BASE 0x00800000 // user memory starts above the kernel's 4 MB page
+#define MAX_FRAMES 64         // 4 MB frames, enough for 256 MB of memory
+
+// GLOBAL FUNCTIONS
+extern void frame_init(uint32_t mem_end);
+extern uint32_t frame_alloc(void);
+extern void frame_free(uint32_t phys_addr);
+extern uint32_t page_alloc(void);
+extern void page_free(uint32_t phys_addr);
+
+#endif
@@ -0,0 +1,178 @@
+// futex.c
+// sleeping waits on a word of user memory. Waiters are keyed on the physical
+// address of the word, so two processes that share it through shm find each
+// other even if they attached it at different addresses. User code only calls
+// in when a lock is contended; taking and releasing a free one is a plain
+// atomic instruction with no system call.
+
+#include "futex.h"
+#include "syscalls.h"
+#include "paging.h"
+#include "lib.h"
+
+typedef struct futex_waiter {
+    struct futex_waiter* next;
+    uint32_t key;   // physical address of the word
+    uint8_t queued; // cleared by futex_wake
+} futex_waiter_t;
+
+// GLOBAL VARIABLES
+static futex_waiter_t waiters[MAX_PROCESSES + 1]; // indexed by PID, a process waits on one word at a time
+static futex_waiter_t* buckets[FUTEX_HASH];
+
+// FUNCTION DECLARATIONS
+int32_t futex_wait(uint32_t* addr, uint32_t val);
+int32_t futex_wake(uint32_t* addr, int32_t count);
+int32_t futex_waiting(uint32_t PID);
+void futex_task_exit(uint32_t PID);
+static uint32_t futex_key(uint32_t* addr);
+static void dequeue(futex_waiter_t* w);
+
+// GLOBAL FUNCTIONS
+/*
+ * futex_wait
+ *   DESCRIPTION:  sleeps until futex_wake is called on addr, unless *addr no
+ *                 longer holds val (the wakeup already happened)
+ *   INPUTS:       addr - aligned user word
+ *                 val - value the caller last saw there
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 0 when woken, -1 if *addr != val, addr is bad or a signal
+ *                 arrived
+ *   SIDE EFFECTS: may sleep
+ */
+int32_t futex_wait(uint32_t* addr, uint32_t val) {
+    futex_waiter_t* w = &waiters[CPID];
+    uint32_t key = futex_key(addr);
+
+    if (!key) {
+        return -1;
+    }
+
+    // the compare and the enqueue happen with interrupts off, so a wake
+    // between them can't be missed
+    cli();
+    if (*addr != val) {
+        sti();
+        return -1;
+    }
+    w->key = key;
+    w->queued = 1;
+    w->next = buckets[(key >> 2) & (FUTEX_HASH - 1)];
+    buckets[(key >> 2) & (FUTEX_HASH - 1)] = w;
+
+    while (w->queued) {
+        if (signal_pending(CPID)) {
+            dequeue(w);
+            sti();
+            return -1;
+        }
+        task_sleep();
+        cli();
+    }
+    sti();
+    return 0;
+}
+
+/*
+ * futex_wake
+ *   DESCRIPTION:  wakes up to count processes waiting on addr
+ *   INPUTS:       addr - aligned user word
+ *                 count - most waiters to wake
+ *   OUTPUTS:      none
+ *   RETURN VALUE: number woken, -1 if addr is bad
+ *   SIDE EFFECTS: none
+ */
+int32_t futex_wake(uint32_t* addr, int32_t count) {
+    uint32_t key = futex_key(addr);
+    futex_waiter_t** link;
+    futex_waiter_t* w;
+    int32_t woken = 0;
+    uint32_t flags;
+
+    if (!key) {
+        return -1;
+    }
+
+    cli_and_save(flags);
+    link = &buckets[(key >> 2) & (FUTEX_HASH - 1)];
+    while (*link != NULL && woken < count) {
+        w = *link;
+        if (w->key == key) {
+            *link = w->next;
+            w->queued = 0;
+            task_wake(w - waiters);
+            woken++;
+        } else {
+            link = &w->next;
+        }
+    }
+    restore_flags(flags);
+    return woken;
+}
+
+/*
+ * futex_waiting
+ *   DESCRIPTION:  checks whether a process is blocked in futex_wait
+ *   INPUTS:       PID of the process
+ *   OUTPUTS:      none
+ *   RETURN VALUE: nonzero if it is
+ *   SIDE EFFECTS: none
+ */
+int32_t futex_waiting(uint32_t PID) {
+    return PID <= MAX_PROCESSES && waiters[PID].queued;
+}
+
+/*
+ * futex_task_exit
+ *   DESCRIPTION:  takes a halting process off its wait queue
+ *   INPUTS:       PID of the process
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void futex_task_exit(uint32_t PID) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (waiters[PID].queued) {
+        dequeue(&waiters[PID]);
+    }
+    restore_flags(flags);
+}
+
+// LOCAL FUNCTIONS
+/*
+ * futex_key
+ *   DESCRIPTION:  physical address of a user word of the current process
+ *   INPUTS:       addr - user address
+ *   OUTPUTS:      none
+ *   RETURN VALUE: the key, 0 if addr is misaligned or not user memory
+ *   SIDE EFFECTS: none
+ */
+static uint32_t futex_key(uint32_t* addr) {
+    if ((uint32_t) addr & 0x3) {
+        return 0;
+    }
+    return user_virt_to_phys(CPID, (uint32_t) addr);
+}
+
+/*
+ * dequeue
+ *   DESCRIPTION:  unlinks a waiter from its bucket
+ *   INPUTS:       w - waiter
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: interrupts must be off
+ */
+static void dequeue(futex_waiter_t* w) {
+    futex_waiter_t** link = &buckets[(w->key >> 2) & (FUTEX_HASH - 1)];
+
+    while (*link != NULL) {
+        if (*link == w) {
+            *link = w->next;
+            break;
+        }
+        link = &(*link)->next;
+    }
+    w->queued = 0;
+}
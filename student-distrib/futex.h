@@ -0,0 +1,18 @@
+// futex.h
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "types.h"
+
+#define FUTEX_HASH 16 // wait queue buckets, power of two
+
+// GLOBAL FUNCTIONS
+extern int32_t futex_waiting(uint32_t PID);
+extern void futex_task_exit(uint32_t PID);
+
+// System Calls
+extern int32_t futex_wait(uint32_t* addr, uint32_t val);
+extern int32_t futex_wake(uint32_t* addr, int32_t count);
+
+#endif
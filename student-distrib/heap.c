@@ -0,0 +1,56 @@
+// heap.c
+// program break. The heap is whatever is left of the image region after the
+// program's file; moving the break only changes which addresses may fault in
+// a zeroed page (see map_demand_page), so memory is used as it is touched.
+
+#include "heap.h"
+#include "syscalls.h"
+#include "paging.h"
+#include "lib.h"
+
+// FUNCTION DECLARATIONS
+int32_t brk(uint32_t addr);
+int32_t sbrk(int32_t increment);
+
+// GLOBAL FUNCTIONS
+/*
+ * brk
+ *   DESCRIPTION:  sets the end of the calling process's heap
+ *   INPUTS:       addr - new break
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 0 if successful, -1 if addr is outside the heap region
+ *   SIDE EFFECTS: frees the pages above a lowered break
+ */
+int32_t brk(uint32_t addr) {
+    uint32_t flags;
+    int32_t ret;
+
+    cli_and_save(flags);
+    ret = set_user_break(CPID, addr);
+    restore_flags(flags);
+
+    return ret;
+}
+
+/*
+ * sbrk
+ *   DESCRIPTION:  moves the end of the calling process's heap
+ *   INPUTS:       increment - bytes to add, negative to give memory back
+ *   OUTPUTS:      none
+ *   RETURN VALUE: the old break, -1 if the heap can't move that far
+ *   SIDE EFFECTS: frees the pages above a lowered break
+ */
+int32_t sbrk(int32_t increment) {
+    uint32_t flags;
+    uint32_t old;
+
+    cli_and_save(flags);
+    old = user_break(CPID);
+    if (old == 0 || set_user_break(CPID, old + increment)) {
+        restore_flags(flags);
+        return -1;
+    }
+    restore_flags(flags);
+
+    return old;
+}
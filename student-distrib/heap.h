@@ -0,0 +1,12 @@
+// heap.h
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "types.h"
+
+// System Calls
+extern int32_t brk(uint32_t addr);
+extern int32_t sbrk(int32_t increment);
+
+#endif
@@ -4,6 +4,7 @@
 
 #include "i8259.h"
 #include "lib.h"
+#include "apic.h"
 
 
 // CONSTANTS
@@ -28,12 +29,18 @@
  * to declare the interrupt finished */
 #define EOI             0x60
 
+/* OCW3 that makes the next read of the command port return the ISR */
+#define OCW3_READ_ISR   0x0B
+
 
 // FUNCTION DECLARATIONS
 void i8259_init();
 void enable_irq(uint8_t  irq_num);
 void disable_irq(uint8_t  irq_num);
+int32_t irq_enabled(uint8_t irq_num);
+int32_t irq_spurious(uint8_t irq_num);
 void send_eoi(uint8_t  irq_num);
+void i8259_to_ioapic();
 
 
 // GLOBAL VARIABLES
@@ -41,6 +48,7 @@ void send_eoi(uint8_t  irq_num);
  * are enabled and disabled */
 static uint8_t  master_mask; /* IRQs 7-0 */
 static uint8_t  slave_mask; /* IRQs 15-8 */
+static uint8_t  routed; /* 1 once IRQs go through the IO-APIC instead */
 
 
 /*
@@ -89,6 +97,11 @@ enable_irq
     RETURNS: none
 */
 void enable_irq(uint8_t  irq_num) {
+    if (routed) {
+        ioapic_set_mask(irq_num, 0);
+        return;
+    }
+
     // check if irq is on master or slave
     if (irq_num < 8) { // master
         if (master_mask & (0x01 << irq_num)) { // not already enabled
@@ -113,6 +126,11 @@ disable_irq
     RETURNS: none
 */
 void disable_irq(uint8_t  irq_num) {
+    if (routed) {
+        ioapic_set_mask(irq_num, 1);
+        return;
+    }
+
     // check if irq is on master or slave
     if (irq_num < 8) { // master
         if (!(master_mask & (0x01 << irq_num))) { // not already disabled
@@ -129,6 +147,55 @@ void disable_irq(uint8_t  irq_num) {
 }
 
 
+/*
+irq_enabled
+    DESCRIPTION: checks whether a specific irq is currently unmasked
+    INPUTS: the number (0-15) of the irq
+    OUTPUTS: none
+    RETURNS: 1 if enabled, 0 if masked
+*/
+int32_t irq_enabled(uint8_t irq_num) {
+    if (routed) {
+        return !ioapic_masked(irq_num);
+    }
+
+    if (irq_num < 8) { // master
+        return (master_mask & (0x01 << irq_num)) ? 0 : 1;
+    }
+    return (slave_mask & (0x01 << (irq_num - 8))) ? 0 : 1;
+}
+
+
+/*
+irq_spurious
+    DESCRIPTION: checks whether an IRQ7 or IRQ15 from the PICs is spurious,
+                 i.e. its ISR bit isn't set. A spurious IRQ7 gets no EOI at
+                 all; for a spurious IRQ15 the master still saw the cascade
+                 line, so it alone gets one here.
+    INPUTS: the number (0-15) of the irq
+    OUTPUTS: none
+    RETURNS: 1 if spurious, 0 otherwise
+    NOTES: interrupts must be off
+*/
+int32_t irq_spurious(uint8_t irq_num) {
+    if (routed || (irq_num != 7 && irq_num != 15)) {
+        return 0;
+    }
+
+    if (irq_num == 7) {
+        outb(OCW3_READ_ISR, MASTER_CMD);
+        return (inb(MASTER_CMD) & 0x80) ? 0 : 1;
+    }
+
+    outb(OCW3_READ_ISR, SLAVE_CMD);
+    if (inb(SLAVE_CMD) & 0x80) {
+        return 0;
+    }
+    outb(EOI | SLAVE_IRQ_NUM, MASTER_CMD);
+    return 1;
+}
+
+
 /*
 send_eoi
     DESCRIPTION: sends EOI to PIC letting it know that a specific IRQ is done being serviced.
@@ -137,10 +204,40 @@ send_eoi
     RETURNS: none
 */
 void send_eoi(uint8_t  irq_num) {
-    if (irq_num < 8) { // master
+    if (routed) {
+        lapic_eoi();
+    } else if (irq_num < 8) { // master
         outb(EOI | irq_num, MASTER_CMD);
     } else { // slave
         outb(EOI | (irq_num - 8), SLAVE_CMD); // Subtract 8 to get IRQ on slave PIC
         outb(EOI | SLAVE_IRQ_NUM, MASTER_CMD); // let master know as well
     }
 }
+
+
+/*
+i8259_to_ioapic
+    DESCRIPTION: hands interrupt delivery over to the IO-APIC (already set up
+                 by ioapic_init) and masks both PICs for good. Every IRQ that
+                 was enabled on the PICs stays enabled.
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+void i8259_to_ioapic() {
+    uint8_t irq;
+    uint16_t mask = (slave_mask << 8) | master_mask;
+
+    for (irq = 0; irq < 16; irq++) {
+        if (irq != SLAVE_IRQ_NUM && !(mask & (0x01 << irq)) && !(irq >= 8 && (master_mask & (0x01 << SLAVE_IRQ_NUM)))) {
+            ioapic_set_mask(irq, 0);
+        }
+    }
+
+    outb(0xFF, MASTER_DATA);
+    outb(0xFF, SLAVE_DATA);
+    master_mask = 0xFF;
+    slave_mask = 0xFF;
+    routed = 1;
+}
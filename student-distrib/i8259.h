@@ -22,7 +22,13 @@ void i8259_init();
 void enable_irq(uint8_t irq_num);
 /* Disable (mask) the specified IRQ */
 void disable_irq(uint8_t irq_num);
+/* Check whether the specified IRQ is unmasked */
+int32_t irq_enabled(uint8_t irq_num);
+/* Check for a spurious IRQ7/15, which must not get a normal EOI */
+int32_t irq_spurious(uint8_t irq_num);
 /* Send end-of-interrupt signal for the specified IRQ */
 void send_eoi(uint8_t irq_num);
+/* Route IRQs through the IO-APIC from now on */
+void i8259_to_ioapic();
 
 #endif /* _I8259_H */
@@ -1,17 +1,60 @@
 // idt.c
+// the IDT and the common interrupt path. Every exception and IRQ vector goes
+// through a generated stub (int_wrapper.S) to interrupt_dispatch, which calls
+// the handler registered for it and keeps per-vector counts and cycle totals,
+// and a histogram per IRQ of the time from the stub to handler completion.
 
+#include "idt.h"
 #include "lib.h"
 #include "x86_desc.h"
 #include "int_wrapper.h"
 #include "syscalls_asm.h"
+#include "kernel_handlers.h"
+#include "apic.h"
+#include "i8259.h"
+#include "pit.h"
+#include "rtc.h"
+#include "terminal.h"
+#include "clock.h"
+#include "syscalls.h"
+#include "paging.h"
 
 // FUNCTION DECLARATIONS
 void idt_init();
+int32_t register_interrupt_handler(uint32_t vector, int_handler_t handler);
+void interrupt_dispatch(hw_context_t* frame, uint64_t entry_tsc);
+void interrupt_stats_stop(void);
+uint64_t interrupt_entry_tsc(void);
+int32_t int_stats(int_stat_t* buf, int32_t count);
+int32_t irq_latency(int32_t irq, irq_latency_t* buf);
+int32_t in_interrupt(void);
+static void latency_record(uint32_t vector, uint64_t cycles);
+static int32_t irq_ack(uint32_t vector);
+static void irq_unmask(uint32_t vector);
+
+// GLOBAL VARIABLES
+static int_handler_t handlers[NUM_INT_STUBS];
+static int_stat_t stats[NUM_INT_STUBS];
+static uint32_t timed_vector = 0; // vector + 1 of the handler being timed, 0 if none
+static uint64_t timed_start;
+static uint64_t timed_entry;      // its stub's rdtsc(), 0 if it shouldn't get a latency sample
+static uint8_t irq_was_enabled[NUM_INT_STUBS - IRQ_VECTOR_BASE]; // set by irq_ack for irq_unmask
+static irq_latency_t latency[NUM_LATENCY_IRQS];
+static volatile uint32_t interrupt_nesting = 0; // IRQ handlers running, one inside the other
 
 
 // GLOBAL FUNCTIONS
+/*
+idt_init
+    DESCRIPTION: points every vector that has a stub at it, registers the
+                 exception and driver handlers and installs the system call gate
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+*/
 void idt_init() {
     idt_desc_t the_idt_desc;
+    uint32_t i;
 
     the_idt_desc.dpl = 0;
     the_idt_desc.size = 1;
@@ -24,102 +67,300 @@ void idt_init() {
 
     the_idt_desc.present = 1;
 
-    idt_desc_t divZero = the_idt_desc;
-    SET_IDT_ENTRY(divZero, divideByZero_wrapper);
-    idt[0] = divZero;
+    for (i = 0; i < NUM_INT_STUBS; i++) {
+        if (interrupt_stubs[i]) {
+            idt_desc_t gate = the_idt_desc;
+            SET_IDT_ENTRY(gate, interrupt_stubs[i]);
+            idt[i] = gate;
+        }
+    }
 
-    idt_desc_t dbug = the_idt_desc;
-    SET_IDT_ENTRY(dbug, debug_wrapper);
-    idt[1] = dbug;
+    register_interrupt_handler(0x00, divideByZero);
+    register_interrupt_handler(0x01, debug);
+    register_interrupt_handler(0x02, nonMaskableInterrupts);
+    register_interrupt_handler(0x03, breakpoint);
+    register_interrupt_handler(0x04, overflow);
+    register_interrupt_handler(0x05, bounds);
+    register_interrupt_handler(0x06, invalidOpCode);
+    register_interrupt_handler(0x07, coprocessorNotAvailable);
+    register_interrupt_handler(0x08, doubleFault);
+    register_interrupt_handler(0x09, coprocessorSegmentOverrun);
+    register_interrupt_handler(0x0A, invalidTaskStateSegment);
+    register_interrupt_handler(0x0B, segmentNotPresent);
+    register_interrupt_handler(0x0C, stackFault);
+    register_interrupt_handler(0x0D, generalProtectionFault);
+    register_interrupt_handler(0x0E, pageFault);
+    register_interrupt_handler(0x0F, reserved);
+    register_interrupt_handler(0x10, mathFault);
+    register_interrupt_handler(0x11, alignmentCheck);
+    register_interrupt_handler(0x12, machineCheck);
+    register_interrupt_handler(0x13, simdFloatingPointException);
 
-    idt_desc_t nmi = the_idt_desc;
-    SET_IDT_ENTRY(nmi, nonMaskableInterrupts_wrapper);
-    idt[2] = nmi;
+    register_interrupt_handler(IRQ_VECTOR_BASE + PIT_IRQ_NUM, pitHandler);
+    register_interrupt_handler(IRQ_VECTOR_BASE + KEYBOARD_IRQ_NUM, keyboardHandler);
+    register_interrupt_handler(IRQ_VECTOR_BASE + RTC_IRQ_NUM, rtcHandler);
+    register_interrupt_handler(LAPIC_TIMER_VECTOR, pitHandler);
 
-    idt_desc_t bpoint = the_idt_desc;
-    SET_IDT_ENTRY(bpoint, breakpoint_wrapper);
-    idt[3] = bpoint;
+    the_idt_desc.reserved3 = 1;
+    the_idt_desc.dpl = 3;
 
-    idt_desc_t oflow = the_idt_desc;
-    SET_IDT_ENTRY(oflow, overflow_wrapper);
-    idt[4] = oflow;
+    idt_desc_t sys = the_idt_desc;
+    SET_IDT_ENTRY(sys, syscall_wrapper);
+    idt[128] = sys;
+}
 
-    idt_desc_t bound = the_idt_desc;
-    SET_IDT_ENTRY(bound, bounds_wrapper);
-    idt[5] = bound;
+/*
+register_interrupt_handler
+    DESCRIPTION: sets the function interrupt_dispatch calls for a vector,
+                 replacing the old one
+    INPUTS: vector - exception or IRQ vector with a stub (below NUM_INT_STUBS)
+            handler - the function, NULL to ignore the vector
+    OUTPUTS: none
+    RETURNS: 0 for success, -1 if the vector has no stub
+*/
+int32_t register_interrupt_handler(uint32_t vector, int_handler_t handler) {
+    if (vector >= NUM_INT_STUBS || !interrupt_stubs[vector]) {
+        return -1;
+    }
+    handlers[vector] = handler;
+    return 0;
+}
 
-    idt_desc_t opCode = the_idt_desc;
-    SET_IDT_ENTRY(opCode, invalidOpCode_wrapper);
-    idt[6] = opCode;
+/*
+interrupt_dispatch
+    DESCRIPTION: common entry of every stub. Calls the registered handler,
+                 charges the time it took to the vector and, for IRQs, adds
+                 the time from the stub to completion to the IRQ's latency
+                 histogram. A handler that switches tasks is only timed up to
+                 the switch (see interrupt_stats_stop), and one that
+                 interrupts another handler pauses the other's clock.
+                 Exception handlers run with interrupts off. IRQ handlers run
+                 with interrupts on and only their own line masked, so a slow
+                 handler can be interrupted by any other IRQ; they must not
+                 switch tasks themselves but set need_resched, which is acted
+                 on once the outermost handler returns.
+    INPUTS: frame - registers saved by the stub
+            entry_tsc - rdtsc() in the stub
+    OUTPUTS: none
+    RETURNS: none
+*/
+void interrupt_dispatch(hw_context_t* frame, uint64_t entry_tsc) {
+    uint32_t vector = frame->irq_num;
+    uint32_t outer = timed_vector;
+    uint64_t outer_entry = timed_entry;
+    uint64_t now;
 
-    idt_desc_t coprocessorNA = the_idt_desc;
-    SET_IDT_ENTRY(coprocessorNA, coprocessorNotAvailable_wrapper);
-    idt[7] = coprocessorNA;
+    if (outer) {
+        stats[outer - 1].cycles += entry_tsc - timed_start;
+    }
+    stats[vector].count++;
+    timed_vector = vector + 1;
+    timed_start = entry_tsc;
+    timed_entry = entry_tsc;
 
-    idt_desc_t dblFault = the_idt_desc;
-    SET_IDT_ENTRY(dblFault, doubleFault_wrapper);
-    idt[8] = dblFault;
+    if (vector >= IRQ_VECTOR_BASE) {
+        // mask and acknowledge this IRQ, then let every other one in while
+        // the handler runs. Spurious ones get neither.
+        if (irq_ack(vector) == 0) {
+            interrupt_nesting++;
+            sti();
+            if (handlers[vector]) {
+                handlers[vector](frame);
+            }
+            cli();
+            interrupt_nesting--;
+            irq_unmask(vector);
+        }
+    } else if (handlers[vector]) {
+        handlers[vector](frame);
+    }
 
-    idt_desc_t coprocessorSO = the_idt_desc;
-    SET_IDT_ENTRY(coprocessorSO, coprocessorSegmentOverrun_wrapper);
-    idt[9] = coprocessorSO;
+    now = rdtsc();
+    if (timed_vector == vector + 1) {
+        stats[vector].cycles += now - timed_start;
+        latency_record(vector, now - entry_tsc);
+    } else {
+        // a task switch came in between, the interrupted handler's total
+        // would include the time it spent switched out
+        outer_entry = 0;
+    }
+    timed_vector = outer;
+    timed_start = now;
+    timed_entry = outer_entry;
 
-    idt_desc_t invalidTSS = the_idt_desc;
-    SET_IDT_ENTRY(invalidTSS, invalidTaskStateSegment_wrapper);
-    idt[10] = invalidTSS;
+    // task switches asked for by handlers wait until the last nested one is done
+    if (!interrupt_nesting && need_resched && CPID != 0) {
+        need_resched = 0;
+        task_switch();
+    }
+}
 
-    idt_desc_t segNotPresent = the_idt_desc;
-    SET_IDT_ENTRY(segNotPresent, segmentNotPresent_wrapper);
-    idt[11] = segNotPresent;
+/*
+in_interrupt
+    DESCRIPTION: tells whether an IRQ handler is running, so code that would
+                 switch tasks sets need_resched instead
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: 1 inside an IRQ handler, 0 otherwise
+*/
+int32_t in_interrupt(void) {
+    return interrupt_nesting != 0;
+}
 
-    idt_desc_t stackF = the_idt_desc;
-    SET_IDT_ENTRY(stackF, stackFault_wrapper);
-    idt[12] = stackF;
+/*
+interrupt_stats_stop
+    DESCRIPTION: stops timing the running handler. Called by task_switch, so
+                 the next task's time isn't counted as interrupt time.
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+void interrupt_stats_stop(void) {
+    uint64_t now;
 
-    idt_desc_t generalProtectFault = the_idt_desc;
-    SET_IDT_ENTRY(generalProtectFault, generalProtectionFault_wrapper);
-    idt[13] = generalProtectFault;
+    if (timed_vector) {
+        now = rdtsc();
+        stats[timed_vector - 1].cycles += now - timed_start;
+        if (timed_entry) {
+            latency_record(timed_vector - 1, now - timed_entry);
+        }
+        timed_vector = 0;
+    }
+}
 
-    idt_desc_t pageF = the_idt_desc;
-    SET_IDT_ENTRY(pageF, pageFault_wrapper);
-    idt[14] = pageF;
+/*
+interrupt_entry_tsc
+    DESCRIPTION: when the interrupt being handled came in
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: rdtsc() in its stub, 0 outside of a handler
+*/
+uint64_t interrupt_entry_tsc(void) {
+    return timed_vector ? timed_entry : 0;
+}
 
-    idt_desc_t reserve = the_idt_desc;
-    SET_IDT_ENTRY(reserve, reserved_wrapper);
-    idt[15] = reserve;
+/*
+ * int_stats
+ *   DESCRIPTION:  copies the interrupt counts and cycle totals out, indexed
+ *                 by vector
+ *   INPUTS:       buf - array of count entries
+ *                 count - number of entries buf has room for
+ *   OUTPUTS:      fills in buf
+ *   RETURN VALUE: number of entries copied, -1 for a bad buffer
+ *   SIDE EFFECTS: none
+ */
+int32_t int_stats(int_stat_t* buf, int32_t count) {
+    uint32_t flags;
 
-    idt_desc_t mathF = the_idt_desc;
-    SET_IDT_ENTRY(mathF, mathFault_wrapper);
-    idt[16] = mathF;
+    if (buf == NULL || count < 0) {
+        return -1;
+    }
+    if (count > NUM_INT_STUBS) {
+        count = NUM_INT_STUBS;
+    }
+    if (!user_range_ok((uint32_t) buf, count * sizeof(int_stat_t))) {
+        return -1;
+    }
 
-    idt_desc_t alignCheck = the_idt_desc;
-    SET_IDT_ENTRY(alignCheck, alignmentCheck_wrapper);
-    idt[17] = alignCheck;
+    cli_and_save(flags);
+    memcpy(buf, stats, count * sizeof(int_stat_t));
+    restore_flags(flags);
+    return count;
+}
 
-    idt_desc_t machCheck = the_idt_desc;
-    SET_IDT_ENTRY(machCheck, machineCheck_wrapper);
-    idt[18] = machCheck;
+/*
+ * irq_latency
+ *   DESCRIPTION:  copies out the latency histogram of one IRQ
+ *   INPUTS:       irq - 0-15 for the ISA IRQs, 16 for the local APIC timer
+ *                 buf - where to put it
+ *   OUTPUTS:      fills in buf
+ *   RETURN VALUE: 0 if successful, -1 for a bad IRQ or buffer
+ *   SIDE EFFECTS: none
+ */
+int32_t irq_latency(int32_t irq, irq_latency_t* buf) {
+    uint32_t flags;
 
-    idt_desc_t simdFPE = the_idt_desc;
-    SET_IDT_ENTRY(simdFPE, simdFloatingPointException_wrapper);
-    idt[19] = simdFPE;
+    if (irq < 0 || irq >= NUM_LATENCY_IRQS || buf == NULL || !user_range_ok((uint32_t) buf, sizeof(irq_latency_t))) {
+        return -1;
+    }
 
-    idt_desc_t rtc = the_idt_desc;
-    SET_IDT_ENTRY(rtc, rtcHandler_wrapper);
-    idt[40] = rtc;
+    cli_and_save(flags);
+    memcpy(buf, &latency[irq], sizeof(irq_latency_t));
+    restore_flags(flags);
+    return 0;
+}
 
-    idt_desc_t kb = the_idt_desc;
-    SET_IDT_ENTRY(kb, keyboardHandler_wrapper);
-    idt[33] = kb;
+// LOCAL FUNCTIONS
+/*
+latency_record
+    DESCRIPTION: adds one sample to an IRQ's latency histogram
+    INPUTS: vector - the IRQ's vector, exceptions are ignored
+            cycles - TSC cycles from its stub to completion
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+static void latency_record(uint32_t vector, uint64_t cycles) {
+    irq_latency_t* lat;
+    uint64_t ns64 = clock_cycles_to_ns(cycles);
+    uint32_t ns, bucket;
 
-    idt_desc_t pit = the_idt_desc;
-    SET_IDT_ENTRY(pit, pitHandler_wrapper);
-    idt[32] = pit;
+    if (vector < IRQ_VECTOR_BASE || vector - IRQ_VECTOR_BASE >= NUM_LATENCY_IRQS) {
+        return;
+    }
+    lat = &latency[vector - IRQ_VECTOR_BASE];
 
-    the_idt_desc.reserved3 = 1;
-    the_idt_desc.dpl = 3;
+    ns = (ns64 > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)ns64;
+    for (bucket = 0; bucket < LATENCY_BUCKETS - 1 && (ns >> (LATENCY_FIRST_SHIFT + bucket)); bucket++);
 
-    idt_desc_t sys = the_idt_desc;
-    SET_IDT_ENTRY(sys, syscall_wrapper);
-    idt[128] = sys;
+    lat->count++;
+    lat->total_ns += ns;
+    if (ns > lat->max_ns) {
+        lat->max_ns = ns;
+    }
+    lat->buckets[bucket]++;
+}
+
+/*
+irq_ack
+    DESCRIPTION: masks an IRQ's line and sends EOI, so the controller passes
+                 on other IRQs while its handler runs. Whether the line was
+                 enabled is remembered for irq_unmask.
+    INPUTS: vector - an IRQ vector
+    OUTPUTS: none
+    RETURNS: 0 on success, -1 if the IRQ was spurious and must be ignored
+    NOTES: interrupts must be off
+*/
+static int32_t irq_ack(uint32_t vector) {
+    uint8_t irq = vector - IRQ_VECTOR_BASE;
+
+    if (vector >= LAPIC_TIMER_VECTOR) {
+        lapic_eoi(); // local timer or IPI, neither needs masking while its handler runs
+        return 0;
+    }
+    if (irq_spurious(irq)) {
+        return -1;
+    }
+    irq_was_enabled[irq] = irq_enabled(irq);
+    disable_irq(irq);
+    send_eoi(irq);
+    return 0;
+}
+
+/*
+irq_unmask
+    DESCRIPTION: lets an IRQ in again after its handler is done, if it was
+                 enabled when it came in
+    INPUTS: vector - an IRQ vector
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+static void irq_unmask(uint32_t vector) {
+    uint8_t irq = vector - IRQ_VECTOR_BASE;
+
+    if (vector < LAPIC_TIMER_VECTOR && irq_was_enabled[irq]) {
+        enable_irq(irq);
+    }
 }
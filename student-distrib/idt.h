@@ -4,7 +4,38 @@
 #define IDT_H
 
 #include "types.h"
+#include "signal.h"
+
+typedef void (*int_handler_t)(hw_context_t* frame);
+
+// per-vector interrupt statistics, see int_stats
+typedef struct {
+    uint32_t count;  // times the vector was taken
+    uint32_t pad;
+    uint64_t cycles; // TSC cycles spent in its handler
+} int_stat_t;
+
+#define NUM_LATENCY_IRQS    17 // the 16 ISA IRQs, then the local APIC timer
+#define LATENCY_BUCKETS     16
+#define LATENCY_FIRST_SHIFT 8  // bucket 0 is under 2^8 ns
+
+// how long one IRQ's handlers took from the stub to completion, see irq_latency
+typedef struct {
+    uint32_t count;
+    uint32_t max_ns;
+    uint64_t total_ns;
+    uint32_t buckets[LATENCY_BUCKETS]; // bucket i > 0: 2^(7+i) to 2^(8+i) ns, the last one open ended
+} irq_latency_t;
 
 extern void idt_init();
+extern int32_t register_interrupt_handler(uint32_t vector, int_handler_t handler);
+extern void interrupt_dispatch(hw_context_t* frame, uint64_t entry_tsc);
+extern void interrupt_stats_stop(void);
+extern uint64_t interrupt_entry_tsc(void);
+extern int32_t in_interrupt(void);
+
+// System Calls
+extern int32_t int_stats(int_stat_t* buf, int32_t count);
+extern int32_t irq_latency(int32_t irq, irq_latency_t* buf);
 
 #endif
@@ -1,28 +1,51 @@
 #ifndef INT_WRAPPER_H
 #define INT_WRAPPER_H
 
-extern void divideByZero_wrapper();
-extern void debug_wrapper();
-extern void nonMaskableInterrupts_wrapper();
-extern void breakpoint_wrapper();
-extern void overflow_wrapper();
-extern void bounds_wrapper();
-extern void invalidOpCode_wrapper();
-extern void coprocessorNotAvailable_wrapper();
-extern void doubleFault_wrapper();
-extern void coprocessorSegmentOverrun_wrapper();
-extern void invalidTaskStateSegment_wrapper();
-extern void segmentNotPresent_wrapper();
-extern void stackFault_wrapper();
-extern void generalProtectionFault_wrapper();
-extern void pageFault_wrapper();
-extern void reserved_wrapper();
-extern void mathFault_wrapper();
-extern void alignmentCheck_wrapper();
-extern void machineCheck_wrapper();
-extern void simdFloatingPointException_wrapper();
-extern void rtcHandler_wrapper();
-extern void keyboardHandler_wrapper();
-extern void pitHandler_wrapper();
+#ifdef ASM
+
+/*
+ * Builds the hw_context_t frame (signal.h) under the vector and error code
+ * pushed by the wrapper, and takes it down again. Frame offsets used from
+ * assembly are below.
+ */
+#define SAVE_ALL    \
+    pushl   %fs    ;\
+    pushl   %es    ;\
+    pushl   %ds    ;\
+    pushl   %eax   ;\
+    pushl   %ebp   ;\
+    pushl   %edi   ;\
+    pushl   %esi   ;\
+    pushl   %edx   ;\
+    pushl   %ecx   ;\
+    pushl   %ebx
+
+#define RESTORE_ALL \
+    popl    %ebx   ;\
+    popl    %ecx   ;\
+    popl    %edx   ;\
+    popl    %esi   ;\
+    popl    %edi   ;\
+    popl    %ebp   ;\
+    popl    %eax   ;\
+    popl    %ds    ;\
+    popl    %es    ;\
+    popl    %fs
+
+#define FRAME_ECX      4
+#define FRAME_EDX      8
+#define FRAME_EAX      24
+#define FRAME_ERR_CODE 44
+#define FRAME_CS       52
+
+#else
+
+#include "types.h"
+
+#define NUM_INT_STUBS 0x32 // exceptions, the 16 ISA IRQs, the local APIC timer and the reschedule IPI
+
+extern uint32_t interrupt_stubs[NUM_INT_STUBS];
+
+#endif /* ASM */
 
 #endif
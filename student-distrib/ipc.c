@@ -0,0 +1,225 @@
+// ipc.c
+// synchronous message passing. send blocks until the receiver replies, and
+// both the send and the reply hand the processor straight to the other side
+// instead of waiting for its turn in the round robin, so a round trip costs
+// about two context switches. Messages are staged in a kernel buffer owned by
+// the sender since the two sides don't share an address space.
+
+#include "ipc.h"
+#include "syscalls.h"
+#include "paging.h"
+#include "lib.h"
+
+// CONSTANTS
+#define IPC_IDLE          0
+#define IPC_SENDING       1 // queued on the receiver
+#define IPC_WAITING_REPLY 2 // picked up by the receiver
+#define IPC_REPLIED       3
+#define IPC_FAILED        4 // the other side went away
+
+typedef struct {
+    uint8_t state;
+    int32_t partner;    // who we are sending to
+    int32_t next;       // next sender queued on the same receiver, 0 for none
+    int32_t queue_head; // senders waiting for us to receive, oldest first
+    int32_t queue_tail;
+    int32_t len;
+    uint8_t data[IPC_MSG_SIZE];
+} ipc_t;
+
+// GLOBAL VARIABLES
+static ipc_t ipc[MAX_PROCESSES + 1]; // indexed by PID
+
+// FUNCTION DECLARATIONS
+int32_t send(int32_t pid, ipc_msg_t* msg);
+int32_t receive(ipc_msg_t* msg);
+int32_t reply(int32_t pid, ipc_msg_t* msg);
+void ipc_task_exit(uint32_t PID);
+static int32_t msg_ok(ipc_msg_t* msg);
+static void fail(int32_t PID);
+
+// GLOBAL FUNCTIONS
+/*
+ * send
+ *   DESCRIPTION:  sends a message to a process and waits for its reply
+ *   INPUTS:       pid - receiver
+ *                 msg - message, len and data are used
+ *   OUTPUTS:      msg is overwritten with the reply
+ *   RETURN VALUE: 0 if successful, -1 if the message is bad or the receiver
+ *                 went away without replying
+ *   SIDE EFFECTS: switches to the receiver
+ */
+int32_t send(int32_t pid, ipc_msg_t* msg) {
+    ipc_t* me = &ipc[CPID];
+    ipc_t* to;
+
+    if (pid < 1 || pid > MAX_PROCESSES || pid == CPID || !msg_ok(msg) || msg->len < 0 || msg->len > IPC_MSG_SIZE) {
+        return -1;
+    }
+    to = &ipc[pid];
+
+    cli();
+    if (!processes[pid].running || processes[pid].kthread) {
+        sti();
+        return -1;
+    }
+
+    me->len = msg->len;
+    memcpy(me->data, msg->data, msg->len);
+    me->partner = pid;
+    me->state = IPC_SENDING;
+    me->next = 0;
+    if (to->queue_tail) {
+        ipc[to->queue_tail].next = CPID;
+    } else {
+        to->queue_head = CPID;
+    }
+    to->queue_tail = CPID;
+
+    // go to sleep and run the receiver right away
+    processes[CPID].sleeping = 1;
+    task_handoff(pid);
+    cli();
+    while (me->state != IPC_REPLIED && me->state != IPC_FAILED) {
+        task_sleep();
+        cli();
+    }
+
+    if (me->state == IPC_FAILED) {
+        me->state = IPC_IDLE;
+        sti();
+        return -1;
+    }
+    me->state = IPC_IDLE;
+    msg->pid = pid;
+    msg->len = me->len;
+    memcpy(msg->data, me->data, me->len);
+    sti();
+    return 0;
+}
+
+/*
+ * receive
+ *   DESCRIPTION:  waits for the next message sent to this process
+ *   INPUTS:       msg - where to put it
+ *   OUTPUTS:      msg->pid is the sender, who must be answered with reply
+ *   RETURN VALUE: PID of the sender, -1 if msg is bad
+ *   SIDE EFFECTS: may sleep
+ */
+int32_t receive(ipc_msg_t* msg) {
+    ipc_t* me = &ipc[CPID];
+    ipc_t* from;
+    int32_t sender;
+
+    if (!msg_ok(msg)) {
+        return -1;
+    }
+
+    cli();
+    while (!me->queue_head) {
+        task_sleep();
+        cli();
+    }
+
+    sender = me->queue_head;
+    from = &ipc[sender];
+    me->queue_head = from->next;
+    if (!me->queue_head) {
+        me->queue_tail = 0;
+    }
+    from->state = IPC_WAITING_REPLY;
+
+    msg->pid = sender;
+    msg->len = from->len;
+    memcpy(msg->data, from->data, from->len);
+    sti();
+    return sender;
+}
+
+/*
+ * reply
+ *   DESCRIPTION:  answers a message picked up by receive and lets its sender
+ *                 run straight away
+ *   INPUTS:       pid - sender of the message
+ *                 msg - reply, len and data are used
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 0 if successful, -1 if pid isn't waiting for our reply
+ *   SIDE EFFECTS: switches to the sender
+ */
+int32_t reply(int32_t pid, ipc_msg_t* msg) {
+    ipc_t* to;
+
+    if (pid < 1 || pid > MAX_PROCESSES || !msg_ok(msg) || msg->len < 0 || msg->len > IPC_MSG_SIZE) {
+        return -1;
+    }
+    to = &ipc[pid];
+
+    cli();
+    if (to->state != IPC_WAITING_REPLY || to->partner != CPID) {
+        sti();
+        return -1;
+    }
+    to->len = msg->len;
+    memcpy(to->data, msg->data, msg->len);
+    to->state = IPC_REPLIED;
+
+    task_handoff(pid);
+    sti();
+    return 0;
+}
+
+/*
+ * ipc_task_exit
+ *   DESCRIPTION:  drops a halting process out of any conversation. Whoever is
+ *                 sending to it or waiting for its reply gets -1 from send.
+ *   INPUTS:       PID of the process
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void ipc_task_exit(uint32_t PID) {
+    ipc_t* me = &ipc[PID];
+    int32_t i, *link;
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    // take ourselves off the receiver's queue
+    if (me->state == IPC_SENDING) {
+        link = &ipc[me->partner].queue_head;
+        ipc[me->partner].queue_tail = 0;
+        while (*link) {
+            if (*link == PID) {
+                *link = me->next;
+            } else {
+                ipc[me->partner].queue_tail = *link;
+                link = &ipc[*link].next;
+            }
+        }
+    }
+
+    // and fail everybody who is talking to us
+    for (i = me->queue_head; i; i = ipc[i].next) {
+        fail(i);
+    }
+    for (i = 1; i <= MAX_PROCESSES; i++) {
+        if (ipc[i].state == IPC_WAITING_REPLY && ipc[i].partner == PID) {
+            fail(i);
+        }
+    }
+
+    me->state = IPC_IDLE;
+    me->queue_head = 0;
+    me->queue_tail = 0;
+    restore_flags(flags);
+}
+
+// LOCAL FUNCTIONS
+static int32_t msg_ok(ipc_msg_t* msg) {
+    return user_range_ok((uint32_t) msg, sizeof(ipc_msg_t));
+}
+
+static void fail(int32_t PID) {
+    ipc[PID].state = IPC_FAILED;
+    task_wake(PID);
+}
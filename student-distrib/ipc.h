@@ -0,0 +1,25 @@
+// ipc.h
+
+#ifndef IPC_H
+#define IPC_H
+
+#include "types.h"
+
+#define IPC_MSG_SIZE 64 // largest message or reply in bytes
+
+// message as seen by user code
+typedef struct {
+    int32_t pid;  // sender (receive) or replier (send)
+    int32_t len;  // bytes used in data
+    uint8_t data[IPC_MSG_SIZE];
+} ipc_msg_t;
+
+// GLOBAL FUNCTIONS
+extern void ipc_task_exit(uint32_t PID);
+
+// System Calls
+extern int32_t send(int32_t pid, ipc_msg_t* msg);
+extern int32_t receive(ipc_msg_t* msg);
+extern int32_t reply(int32_t pid, ipc_msg_t* msg);
+
+#endif
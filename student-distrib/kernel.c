@@ -8,12 +8,18 @@
 #include "i8259.h"
 #include "debug.h"
 #include "paging.h"
+#include "frame.h"
 #include "rtc.h"
 #include "terminal.h"
 #include "idt.h"
 #include "filesys.h"
 #include "syscalls.h"
 #include "pit.h"
+#include "workqueue.h"
+#include "clock.h"
+#include "timer.h"
+#include "vdso.h"
+#include "smp.h"
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
@@ -159,12 +165,25 @@ entry (unsigned long magic, unsigned long addr)
 	/* Init the PIC */
 	i8259_init();
 
+	/* Calibrate the TSC for the monotonic clock */
+	clock_init();
+
+	/* Start the timer wheel off the clock */
+	timer_init();
+
+	/* Publish the clock calibration to user space */
+	vdso_init();
+
 	/* Init RTC */
 	rtc_init();
 
 	/* Init keyboard */
 	enable_irq(KEYBOARD_IRQ_NUM);
 
+	/* Hand the memory above the kernel to user programs; mem_upper counts
+	 * KB from 1 MB up, assume 32 MB if the boot loader didn't say */
+	frame_init(CHECK_FLAG (mbi->flags, 0) ? (mbi->mem_upper + 1024) * 1024 : 0x2000000);
+
 	/* Init paging */
 	if (paging_init()) {
 		printf("ERROR: Paging failed to initialize.\n");
@@ -176,9 +195,20 @@ entry (unsigned long magic, unsigned long addr)
 		printf("ERROR: File system failed to initialize.\n");
 	}
 
+	/* Start the other CPUs; after the file system since the AP trampoline
+	 * overwrites low memory the boot loader left the module list in. They
+	 * wait for the kernel lock, which this CPU holds until the first shell
+	 * enters user space */
+	smp_init();
+
 	/* Init syscalls */
 	syscalls_init();
 
+	/* Init deferred work (needs the PCBs from syscalls_init) */
+	if (workqueue_init()) {
+		printf("ERROR: Work queue failed to initialize.\n");
+	}
+
 	// init PIT
 	pit_init();
 
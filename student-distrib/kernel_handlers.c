@@ -1,115 +1,146 @@
 #include "kernel_handlers.h"
 #include "lib.h"
+#include "paging.h"
 
-void divideByZero()
+void divideByZero(hw_context_t* frame)
 {
+    if (signal_exception(frame, DIV_ZERO))
+        return;
+
     printf("0x00\n");
     printf("OScelot won't let you divide by zero\n");
     exception_halt();
 }
 
-void debug()
+void debug(hw_context_t* frame)
 {
     printf("0x01\n");
     printf("OScelot won't let you debug\n");
     exception_halt();
 }
 
-void nonMaskableInterrupts()
+void nonMaskableInterrupts(hw_context_t* frame)
 {
     printf("0x02\n");
     printf("OScelot asks about NMIs\n");
     exception_halt();
 }
 
-void breakpoint()
+void breakpoint(hw_context_t* frame)
 {
     printf("0x03\n");
     printf("OScelot hits a breakpoint\n");
     exception_halt();
 }
 
-void overflow()
+void overflow(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x04\n");
     printf("OScelot's cup has overflowed\n");
     exception_halt();
 }
 
-void bounds()
+void bounds(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x05\n");
     printf("You are intruding on OScelot's bounds\n");
     exception_halt();
 }
 
-void invalidOpCode()
+void invalidOpCode(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x06\n");
     printf("OScelot doesn't understand your speech\n");
     exception_halt();
 }
 
-void coprocessorNotAvailable()
+void coprocessorNotAvailable(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x07\n");
     printf("OScelot's pardner ain't here yet\n");
     exception_halt();
 }
 
-void doubleFault()
+void doubleFault(hw_context_t* frame)
 {
     printf("0x08\n");
     printf("OScelot hit a wall ... again\n");
     exception_halt();
 }
 
-void coprocessorSegmentOverrun()
+void coprocessorSegmentOverrun(hw_context_t* frame)
 {
     printf("0x09\n");
     printf("OScelot's pardner's segment has been overrun\n");
     exception_halt();
 }
 
-void invalidTaskStateSegment()
+void invalidTaskStateSegment(hw_context_t* frame)
 {
     printf("0x0A\n");
     printf("OScelot's TSS failed. You incompetent programmer\n");
     exception_halt();
 }
 
-void segmentNotPresent()
+void segmentNotPresent(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x0B\n");
     printf("OScelot doesn't know what segment you are talking about\n");
     exception_halt();
 }
 
-void stackFault()
+void stackFault(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x0C\n");
     printf("OScelot suggests you check the stack fault thingamajig\n");
     exception_halt();
 }
 
-void generalProtectionFault()
+void generalProtectionFault(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x0D\n");
     printf("OScelot can't protect you any more\n");
     exception_halt();
 }
 
-void pageFault()
+void pageFault(hw_context_t* frame)
 {
     uint32_t cr2, cr2_P, cr2_RW, cr2_US, cr2_RSVD;
     uint32_t error_code;
     uint32_t bitmask;
 
-    asm volatile("movl %%cr2, %0;" 
-                "movl (%%esp), %%eax;" 
-                "movl %%eax, %1"
-                :"=r" (cr2), "=r" (error_code)              
+    asm volatile("movl %%cr2, %0;"
+                :"=r" (cr2)
                 );
+    error_code = frame->err_code;
+
+    // a stack or heap page that hasn't been touched yet, map it and retry
+    if (!(error_code & 0x1) && !map_demand_page(cr2))
+        return;
+
+    if (signal_exception(frame, SEGFAULT))
+        return;
 
     bitmask = 0x00000001;
     cr2_P = error_code & bitmask;
@@ -135,36 +166,45 @@ void pageFault()
     exception_halt();
 }
 
-void reserved()
+void reserved(hw_context_t* frame)
 {
     printf("0x0F\n");
     printf("OScelot won't let you do that\n");
     exception_halt();
 }
 
-void mathFault()
+void mathFault(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x10\n");
     printf("OScelot can't do the math\n");
     exception_halt();
 }
 
-void alignmentCheck()
+void alignmentCheck(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x11\n");
     printf("OScelot asks you to check your alignment\n");
     exception_halt();
 }
 
-void machineCheck()
+void machineCheck(hw_context_t* frame)
 {
     printf("0x12\n");
     printf("OScelot needs you to check your machine and cry\n");
     exception_halt();
 }
 
-void simdFloatingPointException()
+void simdFloatingPointException(hw_context_t* frame)
 {
+    if (signal_exception(frame, SEGFAULT))
+        return;
+
     printf("0x13\n");
     printf("OScelot can't handle floats right now\n");
     exception_halt();
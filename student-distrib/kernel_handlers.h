@@ -3,25 +3,25 @@
 
 #include "syscalls.h"
 
-extern void divideByZero();
-extern void debug();
-extern void nonMaskableInterrupts();
-extern void breakpoint();
-extern void overflow();
-extern void bounds();
-extern void invalidOpCode();
-extern void coprocessorNotAvailable();
-extern void doubleFault();
-extern void coprocessorSegmentOverrun();
-extern void invalidTaskStateSegment();
-extern void segmentNotPresent();
-extern void stackFault();
-extern void generalProtectionFault();
-extern void pageFault();
-extern void reserved();
-extern void mathFault();
-extern void alignmentCheck();
-extern void machineCheck();
-extern void simdFloatingPointException();
+extern void divideByZero(hw_context_t* frame);
+extern void debug(hw_context_t* frame);
+extern void nonMaskableInterrupts(hw_context_t* frame);
+extern void breakpoint(hw_context_t* frame);
+extern void overflow(hw_context_t* frame);
+extern void bounds(hw_context_t* frame);
+extern void invalidOpCode(hw_context_t* frame);
+extern void coprocessorNotAvailable(hw_context_t* frame);
+extern void doubleFault(hw_context_t* frame);
+extern void coprocessorSegmentOverrun(hw_context_t* frame);
+extern void invalidTaskStateSegment(hw_context_t* frame);
+extern void segmentNotPresent(hw_context_t* frame);
+extern void stackFault(hw_context_t* frame);
+extern void generalProtectionFault(hw_context_t* frame);
+extern void pageFault(hw_context_t* frame);
+extern void reserved(hw_context_t* frame);
+extern void mathFault(hw_context_t* frame);
+extern void alignmentCheck(hw_context_t* frame);
+extern void machineCheck(hw_context_t* frame);
+extern void simdFloatingPointException(hw_context_t* frame);
 
 #endif
@@ -0,0 +1,128 @@
+// kthread.c
+// kernel threads: tasks that live in the spare PCB slots after the user processes,
+// run only in ring 0 on their own kernel stack and borrow whatever page directory
+// was loaded when they got switched in
+
+#include "kthread.h"
+#include "syscalls.h"
+#include "lib.h"
+
+// FUNCTION DECLARATIONS
+int32_t kthread_create(void (*func)(void));
+void kthread_main(void);
+void kthread_sleep(void);
+void kthread_wake(uint32_t PID);
+void kthread_idle(void);
+
+// GLOBAL FUNCTIONS
+/*
+ * kthread_create
+ *   DESCRIPTION:  sets up a PCB for a new kernel thread. The thread starts out
+ *                 asleep and only gets its stack once it is first switched to.
+ *   INPUTS:       func - body of the thread, should never return
+ *   OUTPUTS:      none
+ *   RETURN VALUE: PID of the new thread, -1 if there are no free slots
+ *   SIDE EFFECTS: Overwrites PCB structs
+ */
+int32_t kthread_create(void (*func)(void)) {
+    uint32_t flags;
+    int32_t PID;
+
+    if (func == NULL) {
+        return -1;
+    }
+
+    cli_and_save(flags);
+    for (PID = MAX_PROCESSES + 1; PID < NUM_TASKS; PID++) {
+        if (!processes[PID].running) {
+            processes[PID].PID = PID;
+            processes[PID].PPID = 0;
+            processes[PID].running = 1;
+            processes[PID].active = 0;
+            processes[PID].terminal = 0;
+            processes[PID].using_video_mem = 0;
+            processes[PID].kthread = 1;
+            processes[PID].sleeping = 1;
+            processes[PID].kthread_func = func;
+            processes[PID].esp_switch = 0; // no context yet, task_switch will start it fresh
+            processes[PID].ebp_switch = 0;
+            restore_flags(flags);
+            return PID;
+        }
+    }
+    restore_flags(flags);
+
+    return -1;
+}
+
+/*
+ * kthread_main
+ *   DESCRIPTION:  first function run on a kernel thread's stack (called from
+ *                 task_switch). Runs the thread body and parks the thread for
+ *                 good if it ever returns.
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: none
+ */
+void kthread_main(void) {
+    processes[CPID].kthread_func();
+
+    // body returned, free the slot and never get scheduled again
+    cli();
+    processes[CPID].running = 0;
+    while (1) {
+        kthread_sleep();
+    }
+}
+
+/*
+ * kthread_sleep
+ *   DESCRIPTION:  puts the current kernel thread to sleep until somebody calls
+ *                 kthread_wake on it. Callers should check their wakeup condition
+ *                 with interrupts off right before calling this so no wakeup is lost.
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: context switch
+ */
+void kthread_sleep(void) {
+    task_sleep();
+}
+
+/*
+ * kthread_wake
+ *   DESCRIPTION:  marks a kernel thread runnable. Kernel threads preempt user
+ *                 processes (see task_wake), so deferred work queued from an
+ *                 interrupt runs as soon as the handler is done with the PIC.
+ *   INPUTS:       PID of the kernel thread
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may context switch
+ */
+void kthread_wake(uint32_t PID) {
+    if (PID <= MAX_PROCESSES || PID >= NUM_TASKS || !processes[PID].kthread) {
+        return;
+    }
+
+    task_wake(PID);
+}
+
+/*
+ * kthread_idle
+ *   DESCRIPTION:  body of a CPU's idle thread, which task_switch runs when every
+ *                 other task is asleep or on another CPU. Halts until the next
+ *                 interrupt, without the kernel lock so other CPUs can get in.
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: none
+ */
+void kthread_idle(void) {
+    while (1) {
+        cli();
+        kernel_unlock();
+        asm volatile("sti; hlt");
+        kernel_lock(); // the interrupt that woke us took it already, this only makes sure
+    }
+}
@@ -0,0 +1,15 @@
+// kthread.h
+
+#ifndef KTHREAD_H
+#define KTHREAD_H
+
+#include "types.h"
+
+// GLOBAL FUNCTIONS
+extern int32_t kthread_create(void (*func)(void));
+extern void kthread_main(void);
+extern void kthread_sleep(void);
+extern void kthread_wake(uint32_t PID);
+extern void kthread_idle(void);
+
+#endif
@@ -104,6 +104,73 @@ static inline uint32_t inl(port)
 	return val;
 }
 
+/* Reads the time-stamp counter */
+static inline uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+	asm volatile("rdtsc"
+			: "=a"(lo), "=d"(hi)
+			:
+			: "memory" );
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/* Reads a model-specific register */
+static inline uint64_t rdmsr(uint32_t msr)
+{
+	uint32_t lo, hi;
+	asm volatile("rdmsr"
+			: "=a"(lo), "=d"(hi)
+			: "c"(msr) );
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/* Writes a model-specific register */
+static inline void wrmsr(uint32_t msr, uint64_t val)
+{
+	asm volatile("wrmsr"
+			:
+			: "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32))
+			: "memory" );
+}
+
+/* Drops the TLB entry for the page holding "addr" */
+static inline void invlpg(uint32_t addr)
+{
+	asm volatile("invlpg (%0)"
+			:
+			: "r"(addr)
+			: "memory" );
+}
+
+/* Runs cpuid for leaf "leaf", storing the four result registers in "regs"
+ * (eax, ebx, ecx, edx) */
+static inline void cpuid(uint32_t leaf, uint32_t* regs)
+{
+	asm volatile("cpuid"
+			: "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+			: "a"(leaf), "c"(0) );
+}
+
+/* Divides a 64-bit number by a 32-bit one using two divl's, since we
+ * don't link libgcc and can't use its 64-bit division helpers. Stores
+ * the remainder in "rem" if it isn't NULL. */
+static inline uint64_t div64_32(uint64_t n, uint32_t base, uint32_t* rem)
+{
+	uint32_t hi = (uint32_t)(n >> 32);
+	uint32_t lo = (uint32_t)n;
+	uint32_t q_hi = hi / base;
+	uint32_t q_lo, r;
+	hi = hi % base;
+	asm("divl %4"
+			: "=a"(q_lo), "=d"(r)
+			: "a"(lo), "d"(hi), "rm"(base)
+			: "cc" );
+	if (rem != NULL)
+		*rem = r;
+	return ((uint64_t)q_hi << 32) | q_lo;
+}
+
 /* Writes a byte to a port */
 #define outb(data, port)                \
 do {                                    \
@@ -2,23 +2,57 @@
 
 #include "paging.h"
 #include "lib.h"
+#include "vdso.h"
+#include "apic.h"
+#include "frame.h"
+#include "syscalls.h"
 
 
 // CONSTANTS
 #define KERNEL_LOC 0x00400000
 #define PROCESS_VIDEO_MEMORY_OFFSET 0x00047000
+#define CPUID_PGE 0x00002000 // cpuid leaf 1 edx, global pages supported
+#define PAGE_GLOBAL 0x00000100 // kept in the TLB across CR3 loads
+#define NUM_PAGE_DIRS 7 // the kernel's own directory and one per process
+#define KERNEL_DIR 0 // used by PID 0 and is the template every other directory starts from
+#define cur_dir (cpu_dir[this_cpu()]) // page directory in this CPU's CR3
 
 
 // FUNCTION DECLARATIONS
 int32_t paging_init();
-void new_page_directory(uint32_t PID);
+int32_t new_page_directory(uint32_t PID, uint32_t image_size);
 int32_t new_page_directory_entry (uint32_t PID, uint32_t virt_addr, uint32_t phys_addr, uint8_t size, uint8_t privilege);
 void swap_pages(uint32_t PID);
+void share_page_directory(uint32_t PID, uint32_t owner);
+void release_page_directory(uint32_t PID);
+int32_t map_shared_page(uint32_t PID, uint32_t virt_addr, uint32_t phys_addr);
+void unmap_shared_page(uint32_t PID, uint32_t virt_addr);
+int32_t map_demand_page(uint32_t virt_addr);
+uint32_t user_break(uint32_t PID);
+int32_t set_user_break(uint32_t PID, uint32_t brk);
+uint32_t user_virt_to_phys(uint32_t PID, uint32_t virt_addr);
+int32_t user_range_ok(uint32_t addr, uint32_t size);
+void paging_tlb_flush(void);
+static void load_dir(uint32_t dir);
+static void flush_page(uint32_t dir, uint32_t virt_addr);
+static uint32_t dir_loaded_elsewhere(uint32_t dir);
+static void free_dir(uint32_t dir);
 
 // GLOBAL VARIABLES
-static uint32_t pageDir[7][1024] __attribute__((aligned(4096)));
-static uint32_t first_4MB[7][1024] __attribute__((aligned(4096)));
-static uint32_t video_page_tables[7][1024] __attribute__((aligned(4096)));
+static uint32_t pageDir[NUM_PAGE_DIRS][1024] __attribute__((aligned(4096))); // pool, free ones match the template
+static uint32_t first_4MB[1024] __attribute__((aligned(4096))); // low memory, the same table in every directory
+static uint32_t video_page_tables[NUM_PAGE_DIRS][1024] __attribute__((aligned(4096)));
+static uint32_t shm_page_tables[NUM_PAGE_DIRS][1024] __attribute__((aligned(4096)));
+static uint32_t stack_page_tables[NUM_PAGE_DIRS][1024] __attribute__((aligned(4096)));
+static uint32_t heap_page_tables[NUM_PAGE_DIRS][IMAGE_PDES - 1][1024] __attribute__((aligned(4096))); // image PDEs the file left over
+static uint32_t heap_start[NUM_PAGE_DIRS]; // first PDE after the image
+static uint32_t heap_brk[NUM_PAGE_DIRS]; // program break, pages below it are mapped on first touch
+static uint32_t dir_users[NUM_PAGE_DIRS]; // tasks using each directory, threads share their process's
+static uint32_t dir_next_free[NUM_PAGE_DIRS]; // free list through the pool, 0 ends it
+static uint32_t free_dirs; // first free directory, 0 if there is none
+static uint32_t dir_of[MAX_PROCESSES + 1]; // directory each PID uses, KERNEL_DIR when it has none
+static uint32_t cpu_dir[MAX_CPUS]; // page directory in each CPU's CR3
+static uint32_t global_flag; // PAGE_GLOBAL if the CPU has global pages, 0 if not
 
 
 /*
@@ -52,60 +86,110 @@ int32_t paging_init() {
 
     // initialize pageDir[0]
     int32_t i;
+    uint32_t regs[4];
+
+    // the kernel looks the same in every page directory, so with global pages
+    // its TLB entries survive the CR3 load on every task switch
+    cpuid(1, regs);
+    global_flag = (regs[3] & CPUID_PGE) ? PAGE_GLOBAL : 0;
+
     for (i = 0; i < 1024; i++) {
         pageDir[0][i] = 0x00000002; // this sets the flags to kernel-only, write-enabled, and not-present
     }
 
-    pageDir[0][0] = (uint32_t)(first_4MB[0]) | 0x00000003; // sets flags to accessible-by-kernel, write-enabled, and present
+    pageDir[0][0] = (uint32_t)(first_4MB) | 0x00000003; // sets flags to accessible-by-kernel, write-enabled, and present
     for (i = 0; i < 1024; i++) {
-        first_4MB[0][i] = (i * 0x1000) | 0x00000003; // sets flags to kernel, write-enabled, and present
+        first_4MB[i] = (i * 0x1000) | 0x00000003 | global_flag; // sets flags to kernel, write-enabled, present, and global
     }
-    first_4MB[0][0] &= ~0x00000001; // make first 4kB not present
+    first_4MB[0] &= ~0x00000001; // make first 4kB not present
 
     // initialize kernel 4 MB
-    pageDir[0][1] = KERNEL_LOC | 0x00000083; // maps kernel to 4MiB, sets flags to 4MiB-size, kernel-only, write-enabled, and present
+    pageDir[0][1] = KERNEL_LOC | 0x00000083 | global_flag; // maps kernel to 4MiB, sets flags to 4MiB-size, kernel-only, write-enabled, present, and global
+
+    // APIC registers, identity mapped
+    pageDir[0][APIC_REGION / FOUR_MB] = APIC_REGION | 0x00000093 | global_flag; // sets flags to 4MiB-size, cache-disabled, kernel-only, write-enabled, present, and global
+
+    // the rest of the pool starts out as copies of the kernel's directory,
+    // user page tables start out empty
+    for (i = 1; i < NUM_PAGE_DIRS; i++) {
+        memcpy(pageDir[i], pageDir[KERNEL_DIR], sizeof(pageDir[i]));
+        dir_next_free[i] = (i + 1 < NUM_PAGE_DIRS) ? i + 1 : 0;
+    }
+    free_dirs = 1;
+    for (i = 0; i < 1024; i++) {
+        video_page_tables[0][i] = 0x00000002;
+        shm_page_tables[0][i] = 0x00000002;
+        stack_page_tables[0][i] = 0x00000002;
+    }
+    for (i = 0; i < IMAGE_PDES - 1; i++) {
+        memcpy(heap_page_tables[0][i], stack_page_tables[0], sizeof(heap_page_tables[0][i]));
+    }
+    for (i = 1; i < NUM_PAGE_DIRS; i++) {
+        memcpy(video_page_tables[i], video_page_tables[0], sizeof(video_page_tables[i]));
+        memcpy(shm_page_tables[i], shm_page_tables[0], sizeof(shm_page_tables[i]));
+        memcpy(stack_page_tables[i], stack_page_tables[0], sizeof(stack_page_tables[i]));
+        memcpy(heap_page_tables[i], heap_page_tables[0], sizeof(heap_page_tables[i]));
+    }
+    dir_users[KERNEL_DIR] = 1; // never freed
 
     // enable paging
-    loadPageDir(pageDir[0]);
+    load_dir(KERNEL_DIR);
     enable4MB();
     enablePaging();
+    if (global_flag) {
+        enableGlobalPages();
+    }
 
     return 0;
 }
 
 /*
 new_page_directory
-    DESCRIPTION: creates page directory for a process
-    INPUTS: process ID
+    DESCRIPTION: takes a directory from the pool for a process and loads it. Only the
+                 process's own entries are written, the kernel ones are already in place.
+                 The image gets whole 4 MB frames, the heap (the rest of the image
+                 region) and the stack start out empty.
+    INPUTS: process ID, bytes from PROGRAM_IMAGE the program image needs
     OUTPUTS: none
-    RETURNS: none
+    RETURNS: 0 for success, -1 if the pool or memory is empty or the image is too big
 */
-void new_page_directory(uint32_t PID) {
-    // initialize pageDir[PID]
+int32_t new_page_directory(uint32_t PID, uint32_t image_size) {
+    uint32_t dir = free_dirs;
+    uint32_t pdes = (image_size + FOUR_MB - 1) / FOUR_MB;
+    uint32_t frame;
     int32_t i;
-    for (i = 0; i < 1024; i++) {
-        pageDir[PID][i] = 0x00000002; // this sets the flags to kernel-only, write-enabled, and not-present
-    }
 
-    pageDir[PID][0] = (uint32_t)(first_4MB[PID]) | 0x00000003; // sets flags to accessible-by-kernel, write-enabled, and present
-    for (i = 0; i < 1024; i++) {
-        first_4MB[PID][i] = (i * 0x1000) | 0x00000003; // sets flags to kernel, write-enabled, and present
+    if (dir == 0 || pdes == 0 || pdes > IMAGE_PDES) {
+        return -1;
     }
-    first_4MB[PID][0] &= ~0x00000001; // make first 4kB not present
+    free_dirs = dir_next_free[dir];
 
-    // initialize kernel 4 MB
-    pageDir[PID][1] = KERNEL_LOC | 0x00000083; // maps kernel to 4MiB, sets flags to 4MiB-size, kernel-only, write-enabled, and present
+    for (i = 0; i < pdes; i++) {
+        if (!(frame = frame_alloc())) {
+            free_dir(dir);
+            return -1;
+        }
+        pageDir[dir][PROGRAM_IMAGE / FOUR_MB + i] = frame | 0x00000087; // 4MB page for program image is set to user, write-enabled, and present
+    }
 
-    uint32_t phys_addr = FOUR_MB * (PID + 1);
-    uint32_t dir_entry = PROGRAM_IMAGE / FOUR_MB;
+    // heap pages come in through map_demand_page once brk covers them
+    for (; i < IMAGE_PDES; i++) {
+        pageDir[dir][PROGRAM_IMAGE / FOUR_MB + i] = (uint32_t)(heap_page_tables[dir][i - 1]) | 0x00000007; // sets flags to user-level, write-enabled, and present
+    }
+    heap_start[dir] = PROGRAM_IMAGE + pdes * FOUR_MB;
+    heap_brk[dir] = heap_start[dir];
 
-    pageDir[PID][dir_entry] = phys_addr | 0x00000087; // 4MB page for program image is set to user, write-enabled, and present
+    // stack pages come in through map_demand_page
+    pageDir[dir][USER_STACK_BOTTOM / FOUR_MB] = (uint32_t)(stack_page_tables[dir]) | 0x00000007; // sets flags to user-level, write-enabled, and present
 
-    // enable paging
-    loadPageDir(pageDir[PID]);
-    enable4MB();
-    enablePaging();
+    // vDSO data page
+    pageDir[dir][USER_PAGE_BOTTOM / FOUR_MB] = (uint32_t)(video_page_tables[dir]) | 0x00000007; // sets flags to user-level, write-enabled, and present
+    video_page_tables[dir][(VDSO_ADDR >> 12) & 0x3FF] = (uint32_t)vdso | 0x00000005; // 4KB page set to user-level, read-only, and present
 
+    dir_users[dir] = 1;
+    dir_of[PID] = dir;
+    load_dir(dir);
+    return 0;
 }
 
 /*
@@ -119,6 +203,11 @@ int32_t new_page_directory_entry (uint32_t PID, uint32_t virt_addr, uint32_t phy
     uint32_t pde = virt_addr >> 22;
     uint32_t pte = (virt_addr >> 12) & 0x3FF;
 
+    PID = dir_of[PID];
+    if (PID == KERNEL_DIR) {
+        return -1;
+    }
+
     if (size == 0) { // 4 KB pages
         if (privilege == 3) {
             pageDir[PID][pde] = (uint32_t)(video_page_tables[PID]) | 0x00000007;  // sets flags to user-level, write-enabled, and present
@@ -136,7 +225,7 @@ int32_t new_page_directory_entry (uint32_t PID, uint32_t virt_addr, uint32_t phy
             pageDir[PID][pde] = (phys_addr & ~0x3FFFFF) | 0x00000083;  // sets flags to kernel, write-enabled, and present
     }
 
-    loadPageDir(pageDir[PID]);
+    flush_page(PID, virt_addr);
     return 0;
 }
 
@@ -148,5 +237,358 @@ swap_pages
     RETURNS: none
 */
 void swap_pages(uint32_t PID) {
-    loadPageDir(pageDir[PID]);
+    // threads of one process share a directory, nothing to flush between them
+    if (dir_of[PID] != cur_dir) {
+        load_dir(dir_of[PID]);
+    }
+}
+
+/*
+share_page_directory
+    DESCRIPTION: makes a task use another task's page directory (threads)
+    INPUTS: process ID of the task, process ID that owns the directory
+    OUTPUTS: none
+    RETURNS: none
+*/
+void share_page_directory(uint32_t PID, uint32_t owner) {
+    dir_of[PID] = dir_of[owner];
+    dir_users[dir_of[PID]]++;
+}
+
+/*
+release_page_directory
+    DESCRIPTION: drops a task's hold on its page directory. The last task to let go
+                 returns it to the pool, once it is no longer loaded. Other CPUs that
+                 still have it loaded (kernel threads borrow whatever was) are made to
+                 drop it right away.
+    INPUTS: process ID
+    OUTPUTS: none
+    RETURNS: none
+*/
+void release_page_directory(uint32_t PID) {
+    uint32_t dir = dir_of[PID];
+    uint32_t others;
+
+    if (dir == KERNEL_DIR) {
+        return;
+    }
+    dir_of[PID] = KERNEL_DIR;
+    if (--dir_users[dir] == 0) {
+        if ((others = dir_loaded_elsewhere(dir))) {
+            smp_flush_tlb(others);
+        }
+        if (dir != cur_dir) {
+            free_dir(dir);
+        }
+    }
+}
+
+/*
+map_shared_page
+    DESCRIPTION: maps a 4 KB user page into a process's shared memory window
+    INPUTS: process ID, virtual address (inside SHM_WINDOW), physical address
+    OUTPUTS: none
+    RETURNS: 0 for success, -1 if the address is outside the window or taken
+*/
+int32_t map_shared_page(uint32_t PID, uint32_t virt_addr, uint32_t phys_addr) {
+    uint32_t pte = (virt_addr >> 12) & 0x3FF;
+
+    PID = dir_of[PID];
+
+    if (PID == KERNEL_DIR || (virt_addr & ~0x3FFFFF) != SHM_WINDOW || (shm_page_tables[PID][pte] & 0x00000001)) {
+        return -1;
+    }
+
+    pageDir[PID][SHM_WINDOW / FOUR_MB] = (uint32_t)(shm_page_tables[PID]) | 0x00000007; // sets flags to user-level, write-enabled, and present
+    shm_page_tables[PID][pte] = (phys_addr & ~0xFFF) | 0x00000007; // 4KB page set to user-level, write-enabled, and present
+
+    flush_page(PID, virt_addr);
+    return 0;
+}
+
+/*
+unmap_shared_page
+    DESCRIPTION: removes a page mapped by map_shared_page
+    INPUTS: process ID, virtual address
+    OUTPUTS: none
+    RETURNS: none
+*/
+void unmap_shared_page(uint32_t PID, uint32_t virt_addr) {
+    PID = dir_of[PID];
+
+    if ((virt_addr & ~0x3FFFFF) != SHM_WINDOW) {
+        return;
+    }
+
+    shm_page_tables[PID][(virt_addr >> 12) & 0x3FF] = 0x00000002;
+    flush_page(PID, virt_addr);
+}
+
+/*
+map_demand_page
+    DESCRIPTION: maps a zeroed page into the loaded directory after a fault on a stack
+                 page or a heap page below the break that hasn't been touched yet. The
+                 fault can come from user code or from the kernel copying to user memory.
+    INPUTS: faulting virtual address
+    OUTPUTS: none
+    RETURNS: 0 if the page is mapped now, -1 if the address isn't a missing demand page
+*/
+int32_t map_demand_page(uint32_t virt_addr) {
+    uint32_t pde = pageDir[cur_dir][virt_addr >> 22];
+    uint32_t* table = (uint32_t*)(pde & ~0xFFF);
+    uint32_t pte = (virt_addr >> 12) & 0x3FF;
+    uint32_t page;
+
+    if (cur_dir == KERNEL_DIR) {
+        return -1;
+    }
+    if (!(virt_addr >= USER_STACK_BOTTOM && virt_addr < USER_STACK_TOP) &&
+        !(virt_addr >= heap_start[cur_dir] && virt_addr < heap_brk[cur_dir])) {
+        return -1;
+    }
+    if ((pde & 0x00000081) != 0x00000001 || (table[pte] & 0x00000001)) { // needs a page table, and a missing page in it
+        return -1;
+    }
+    if (!(page = page_alloc())) {
+        return -1;
+    }
+
+    // not-present entries are never cached, so there is nothing to flush
+    table[pte] = page | 0x00000007; // 4KB page set to user-level, write-enabled, and present
+    memset((void*)(virt_addr & ~0xFFF), 0, 4096);
+    return 0;
+}
+
+/*
+user_break
+    DESCRIPTION: looks up a process's program break
+    INPUTS: process ID
+    OUTPUTS: none
+    RETURNS: the break, 0 if the process has no directory
+*/
+uint32_t user_break(uint32_t PID) {
+    uint32_t dir = dir_of[PID];
+
+    return (dir == KERNEL_DIR) ? 0 : heap_brk[dir];
+}
+
+/*
+set_user_break
+    DESCRIPTION: moves a process's program break. Growing only moves the limit, pages
+                 are mapped as they are touched; pages above a lowered break are freed.
+    INPUTS: process ID, new break
+    OUTPUTS: none
+    RETURNS: 0 for success, -1 if the break would leave the heap
+*/
+int32_t set_user_break(uint32_t PID, uint32_t brk) {
+    uint32_t dir = dir_of[PID];
+    uint32_t addr;
+    uint32_t* pte;
+
+    if (dir == KERNEL_DIR || brk < heap_start[dir] || brk > PROGRAM_IMAGE + IMAGE_PDES * FOUR_MB) {
+        return -1;
+    }
+
+    for (addr = (brk + 0xFFF) & ~0xFFF; addr < heap_brk[dir]; addr += 0x1000) {
+        pte = &heap_page_tables[dir][(addr - PROGRAM_IMAGE) / FOUR_MB - 1][(addr >> 12) & 0x3FF];
+        if (*pte & 0x00000001) {
+            page_free(*pte & ~0xFFF);
+            *pte = 0x00000002;
+            flush_page(dir, addr);
+        }
+    }
+
+    heap_brk[dir] = brk;
+    return 0;
+}
+
+/*
+user_virt_to_phys
+    DESCRIPTION: looks up where a user address of a process lives in memory
+    INPUTS: process ID, virtual address
+    OUTPUTS: none
+    RETURNS: physical address, 0 if the address isn't mapped for user access
+*/
+uint32_t user_virt_to_phys(uint32_t PID, uint32_t virt_addr) {
+    uint32_t pde = pageDir[dir_of[PID]][virt_addr >> 22];
+    uint32_t pte;
+
+    if ((pde & 0x00000005) != 0x00000005) { // user and present
+        return 0;
+    }
+    if (pde & 0x00000080) { // 4 MB page
+        return (pde & ~0x3FFFFF) | (virt_addr & 0x3FFFFF);
+    }
+
+    pte = ((uint32_t*)(pde & ~0xFFF))[(virt_addr >> 12) & 0x3FF];
+    if ((pte & 0x00000005) != 0x00000005) {
+        return 0;
+    }
+    return (pte & ~0xFFF) | (virt_addr & 0xFFF);
+}
+
+
+/*
+user_range_ok
+    DESCRIPTION: checks that a buffer a system call was handed lies in memory the loaded
+                 process can use: its image and heap up to the break, the stack region,
+                 or shared memory it has attached.
+                 Pages there that were never touched are mapped when the kernel faults on
+                 them, anything else would be a kernel page fault.
+    INPUTS: addr - start of the buffer
+            size - length in bytes
+    OUTPUTS: none
+    RETURNS: 1 if it does, 0 if not
+*/
+int32_t user_range_ok(uint32_t addr, uint32_t size) {
+    uint32_t page;
+
+    if (cur_dir == KERNEL_DIR) {
+        return 0;
+    }
+    if (addr >= PROGRAM_IMAGE && addr < heap_brk[cur_dir]) {
+        return size <= heap_brk[cur_dir] - addr;
+    }
+    if (addr >= USER_STACK_BOTTOM && addr < USER_STACK_TOP) {
+        return size <= USER_STACK_TOP - addr;
+    }
+    if (addr >= SHM_WINDOW && addr < SHM_WINDOW + FOUR_MB) {
+        // only pages a segment is attached at, nothing faults those in
+        if (size > SHM_WINDOW + FOUR_MB - addr || !(pageDir[cur_dir][SHM_WINDOW / FOUR_MB] & 0x00000001)) {
+            return 0;
+        }
+        page = addr & ~0xFFF;
+        do {
+            if (!(shm_page_tables[cur_dir][(page >> 12) & 0x3FF] & 0x00000001)) {
+                return 0;
+            }
+            page += 0x1000;
+        } while (page < addr + size);
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+paging_tlb_flush
+    DESCRIPTION: reloads CR3 for smp_flush_tlb. A directory whose tasks are all gone
+                 is swapped for the kernel's instead, so the CPU that asked can free it.
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+*/
+void paging_tlb_flush(void) {
+    if (dir_users[cur_dir] == 0) {
+        cur_dir = KERNEL_DIR;
+    }
+    loadPageDir(pageDir[cur_dir]);
+}
+
+// LOCAL FUNCTIONS
+/*
+load_dir
+    DESCRIPTION: loads a page directory into CR3, which flushes every non-global TLB entry
+    INPUTS: page directory index
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void load_dir(uint32_t dir) {
+    uint32_t old = cur_dir;
+
+    cur_dir = dir;
+    loadPageDir(pageDir[dir]);
+
+    // its last task is gone, it was only kept until now because it was loaded
+    if (dir_users[old] == 0 && old != dir) {
+        free_dir(old);
+    }
+}
+
+/*
+flush_page
+    DESCRIPTION: drops the stale TLB entry after one mapping changed. A directory that
+                 isn't loaded has nothing cached, loading it later flushes anyway. Other
+                 CPUs that have it loaded are sent a TLB flush and waited for.
+    INPUTS: page directory index, virtual address that was remapped
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void flush_page(uint32_t dir, uint32_t virt_addr) {
+    uint32_t others;
+
+    if (dir == cur_dir) {
+        invlpg(virt_addr);
+    }
+    if ((others = dir_loaded_elsewhere(dir))) {
+        smp_flush_tlb(others);
+    }
+}
+
+/*
+dir_loaded_elsewhere
+    DESCRIPTION: finds the other CPUs that have a directory loaded
+    INPUTS: page directory index
+    OUTPUTS: none
+    RETURNS: bit n set if cpus[n] has it in CR3
+*/
+static uint32_t dir_loaded_elsewhere(uint32_t dir) {
+    uint32_t i;
+    uint32_t mask = 0;
+
+    for (i = 0; i < num_cpus; i++) {
+        if (i != this_cpu() && cpus[i].online && cpu_dir[i] == dir) {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+/*
+free_dir
+    DESCRIPTION: puts a directory back into the pool along with the program's image frames,
+                 heap pages and stack pages. Only entries that differ from the template are
+                 rewritten, which is a handful for any process.
+    INPUTS: page directory index
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void free_dir(uint32_t dir) {
+    uint32_t addr;
+    uint32_t* pte;
+    int32_t i;
+
+    for (i = 0; i < IMAGE_PDES; i++) {
+        if ((pageDir[dir][PROGRAM_IMAGE / FOUR_MB + i] & 0x00000081) == 0x00000081) { // image frame, not a heap table
+            frame_free(pageDir[dir][PROGRAM_IMAGE / FOUR_MB + i] & ~0x3FFFFF);
+        }
+    }
+    for (addr = heap_start[dir]; addr < heap_brk[dir]; addr += 0x1000) {
+        pte = &heap_page_tables[dir][(addr - PROGRAM_IMAGE) / FOUR_MB - 1][(addr >> 12) & 0x3FF];
+        if (*pte & 0x00000001) {
+            page_free(*pte & ~0xFFF);
+            *pte = 0x00000002;
+        }
+    }
+    heap_start[dir] = 0;
+    heap_brk[dir] = 0;
+
+    for (i = 0; i < 1024; i++) {
+        if (stack_page_tables[dir][i] & 0x00000001) {
+            page_free(stack_page_tables[dir][i] & ~0xFFF);
+            stack_page_tables[dir][i] = 0x00000002;
+        }
+        if (pageDir[dir][i] != pageDir[KERNEL_DIR][i]) {
+            pageDir[dir][i] = pageDir[KERNEL_DIR][i];
+        }
+        if (video_page_tables[dir][i] & 0x00000001) {
+            video_page_tables[dir][i] = 0x00000002;
+        }
+        if (shm_page_tables[dir][i] & 0x00000001) {
+            shm_page_tables[dir][i] = 0x00000002;
+        }
+    }
+
+    dir_next_free[dir] = free_dirs;
+    free_dirs = dir;
 }
@@ -6,10 +6,14 @@
 
 #include "types.h"
 
-#define FOUR_MB          0x00400000
-#define USER_PAGE_BOTTOM 0x08400000
-#define PROGRAM_IMAGE    0x08000000
-#define VIDEO_MEMORY     0x000B8000
+#define FOUR_MB           0x00400000
+#define PROGRAM_IMAGE     0x08000000 // program image, in as many 4 MB pages as the file needs, then the heap
+#define IMAGE_PDES        4          // so images and heap together can be up to 16 MB
+#define USER_STACK_BOTTOM 0x09000000 // 4 MB stack region, 4 KB pages mapped as the stack grows down
+#define USER_STACK_TOP    0x09400000
+#define USER_PAGE_BOTTOM  0x09400000 // vidmap, syscall ring and vDSO pages, user memory ends here
+#define VIDEO_MEMORY      0x000B8000
+#define SHM_WINDOW        0x09800000 // 4 MB of user space above the vidmap table for shared memory
 
 // GLOBAL VAR: pageDir
 
@@ -17,9 +21,20 @@ extern int32_t paging_init();
 extern void loadPageDir(uint32_t *);
 extern void enablePaging();
 extern void enable4MB();
-extern void new_page_directory(uint32_t PID);
+extern void enableGlobalPages();
+extern int32_t new_page_directory(uint32_t PID, uint32_t image_size);
 extern void swap_pages(uint32_t PID);
+extern void share_page_directory(uint32_t PID, uint32_t owner);
+extern void release_page_directory(uint32_t PID);
 extern int32_t new_page_directory_entry (uint32_t PID, uint32_t virt_addr, uint32_t phys_addr, uint8_t size, uint8_t privilege);
+extern int32_t map_shared_page(uint32_t PID, uint32_t virt_addr, uint32_t phys_addr);
+extern void unmap_shared_page(uint32_t PID, uint32_t virt_addr);
+extern int32_t map_demand_page(uint32_t virt_addr);
+extern uint32_t user_break(uint32_t PID);
+extern int32_t set_user_break(uint32_t PID, uint32_t brk);
+extern uint32_t user_virt_to_phys(uint32_t PID, uint32_t virt_addr);
+extern int32_t user_range_ok(uint32_t addr, uint32_t size);
+extern void paging_tlb_flush(void);
 
 
 #endif
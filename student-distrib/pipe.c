@@ -0,0 +1,280 @@
+// pipe.c
+// anonymous pipes. Each pipe is a page-sized ring buffer with a wait queue for
+// each end; readers block while it is empty and writers while it is full.
+// The read end returns 0 once every writer is gone, the write end fails once
+// every reader is gone.
+
+#include "pipe.h"
+#include "syscalls.h"
+#include "paging.h"
+#include "lib.h"
+
+// CONSTANTS
+#define PIPE_MASK (PIPE_SIZE - 1)
+
+typedef struct {
+    uint32_t head;          // bytes read so far, the ring is indexed by head/tail & PIPE_MASK
+    uint32_t tail;          // bytes written so far
+    uint32_t readers;       // open read ends (fds, across processes)
+    uint32_t writers;       // open write ends
+    uint32_t read_waiters;  // bitmask of PIDs blocked reading
+    uint32_t write_waiters; // bitmask of PIDs blocked writing
+    uint8_t in_use;
+} pipe_t;
+
+// GLOBAL VARIABLES
+static uint8_t pipe_bufs[MAX_PIPES][PIPE_SIZE] __attribute__((aligned(4096)));
+static pipe_t pipes[MAX_PIPES];
+static int32_t pipe_no_read(file_t* file, uint8_t* buf, int32_t nbytes);
+static int32_t pipe_no_write(file_t* file, uint8_t* buf, int32_t nbytes);
+static fileops_t pipe_read_jumptable = {pipe_open, pipe_read, pipe_no_write, pipe_close};
+static fileops_t pipe_write_jumptable = {pipe_open, pipe_no_read, pipe_write, pipe_close};
+
+// FUNCTION DECLARATIONS
+int32_t pipe(int32_t* fds);
+void pipe_dup(file_t* file);
+int32_t pipe_open(file_t* file);
+int32_t pipe_read(file_t* file, uint8_t* buf, int32_t nbytes);
+int32_t pipe_write(file_t* file, uint8_t* buf, int32_t nbytes);
+int32_t pipe_close(file_t* file);
+static void wake_all(uint32_t* waiters);
+
+// GLOBAL FUNCTIONS
+/*
+ * pipe
+ *   DESCRIPTION:  creates a pipe and opens both ends in the calling process
+ *   INPUTS:       fds - where to store the descriptors
+ *   OUTPUTS:      fds[0] is the read end, fds[1] the write end
+ *   RETURN VALUE: 0 if successful, -1 if not
+ *   SIDE EFFECTS: none
+ */
+int32_t pipe(int32_t* fds) {
+    int32_t i, p, rfd = -1, wfd = -1;
+    file_t* fd_array = processes[CPID].files;
+
+    if (fds == NULL || !user_range_ok((uint32_t) fds, 2 * sizeof(int32_t))) {
+        return -1;
+    }
+
+    for (i = 2; i < MAX_FD; i++) {
+        if (!fd_array[i].flags.in_use) {
+            if (rfd < 0) {
+                rfd = i;
+            } else {
+                wfd = i;
+                break;
+            }
+        }
+    }
+    if (wfd < 0) {
+        return -1;
+    }
+
+    for (p = 0; p < MAX_PIPES; p++) {
+        if (!pipes[p].in_use) {
+            break;
+        }
+    }
+    if (p == MAX_PIPES) {
+        return -1;
+    }
+
+    pipes[p].head = 0;
+    pipes[p].tail = 0;
+    pipes[p].readers = 1;
+    pipes[p].writers = 1;
+    pipes[p].read_waiters = 0;
+    pipes[p].write_waiters = 0;
+    pipes[p].in_use = 1;
+
+    fd_array[rfd].jumptable = &pipe_read_jumptable;
+    fd_array[rfd].inode = p;
+    fd_array[rfd].position = 0;
+    fd_array[rfd].flags.in_use = 1;
+
+    fd_array[wfd].jumptable = &pipe_write_jumptable;
+    fd_array[wfd].inode = p;
+    fd_array[wfd].position = 0;
+    fd_array[wfd].flags.in_use = 1;
+
+    fds[0] = rfd;
+    fds[1] = wfd;
+    return 0;
+}
+
+/*
+pipe_dup
+    DESCRIPTION: accounts for a copy of a descriptor being handed to another
+                 process, does nothing if it isn't a pipe
+    INPUTS: file - the copy
+    OUTPUTS: none
+    RETURNS: none
+*/
+void pipe_dup(file_t* file) {
+    if (file->jumptable == &pipe_read_jumptable) {
+        pipes[file->inode].readers++;
+    } else if (file->jumptable == &pipe_write_jumptable) {
+        pipes[file->inode].writers++;
+    }
+}
+
+/*
+pipe_open
+    DESCRIPTION: pipes are made by the pipe system call, not opened by name
+    INPUTS: file - unused
+    OUTPUTS: none
+    RETURNS: -1
+*/
+int32_t pipe_open(file_t* file) {
+    return -1;
+}
+
+/*
+pipe_read
+    DESCRIPTION: reads whatever is in the pipe, up to nbytes, blocking while it
+                 is empty and somebody can still write to it
+    INPUTS: file - read end
+            buf - where to put the data
+            nbytes - most bytes to read
+    OUTPUTS: data in buf
+    RETURNS: bytes read, 0 at end of file
+*/
+int32_t pipe_read(file_t* file, uint8_t* buf, int32_t nbytes) {
+    pipe_t* p = &pipes[file->inode];
+    uint8_t* data = pipe_bufs[file->inode];
+    int32_t i, count;
+
+    if (buf == NULL || nbytes < 0 || !user_range_ok((uint32_t) buf, nbytes)) {
+        return -1;
+    }
+
+    cli();
+    while (p->head == p->tail) {
+        if (p->writers == 0) {
+            sti();
+            return 0;
+        }
+        p->read_waiters |= 1 << CPID;
+        task_sleep();
+        cli();
+    }
+
+    count = p->tail - p->head;
+    if (count > nbytes) {
+        count = nbytes;
+    }
+    for (i = 0; i < count; i++) {
+        buf[i] = data[(p->head + i) & PIPE_MASK];
+    }
+    p->head += count;
+
+    wake_all(&p->write_waiters);
+    sti();
+    return count;
+}
+
+/*
+pipe_write
+    DESCRIPTION: writes all of buf into the pipe, blocking while it is full
+    INPUTS: file - write end
+            buf - data to write
+            nbytes - number of bytes
+    OUTPUTS: none
+    RETURNS: bytes written, -1 if nobody can read them
+*/
+int32_t pipe_write(file_t* file, uint8_t* buf, int32_t nbytes) {
+    pipe_t* p = &pipes[file->inode];
+    uint8_t* data = pipe_bufs[file->inode];
+    int32_t i, count, written = 0;
+
+    if (buf == NULL || nbytes < 0 || !user_range_ok((uint32_t) buf, nbytes)) {
+        return -1;
+    }
+
+    while (written < nbytes) {
+        cli();
+        while (p->tail - p->head == PIPE_SIZE) {
+            if (p->readers == 0) {
+                break;
+            }
+            p->write_waiters |= 1 << CPID;
+            task_sleep();
+            cli();
+        }
+        if (p->readers == 0) {
+            sti();
+            return written ? written : -1;
+        }
+
+        count = PIPE_SIZE - (p->tail - p->head);
+        if (count > nbytes - written) {
+            count = nbytes - written;
+        }
+        for (i = 0; i < count; i++) {
+            data[(p->tail + i) & PIPE_MASK] = buf[written + i];
+        }
+        p->tail += count;
+        written += count;
+
+        wake_all(&p->read_waiters);
+        sti();
+    }
+    return written;
+}
+
+/*
+pipe_close
+    DESCRIPTION: closes one end, waking the other side so it sees end of file
+                 or a broken pipe. The pipe is freed once both ends are gone.
+    INPUTS: file - the end being closed
+    OUTPUTS: none
+    RETURNS: 0
+*/
+int32_t pipe_close(file_t* file) {
+    pipe_t* p = &pipes[file->inode];
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (file->jumptable == &pipe_read_jumptable) {
+        p->readers--;
+        wake_all(&p->write_waiters);
+    } else {
+        p->writers--;
+        wake_all(&p->read_waiters);
+    }
+    if (p->readers == 0 && p->writers == 0) {
+        p->in_use = 0;
+    }
+    restore_flags(flags);
+    return 0;
+}
+
+// LOCAL FUNCTIONS
+static int32_t pipe_no_read(file_t* file, uint8_t* buf, int32_t nbytes) {
+    return -1;
+}
+
+static int32_t pipe_no_write(file_t* file, uint8_t* buf, int32_t nbytes) {
+    return -1;
+}
+
+/*
+wake_all
+    DESCRIPTION: wakes every task in a wait queue and empties it
+    INPUTS: waiters - the queue
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+static void wake_all(uint32_t* waiters) {
+    uint32_t PID;
+    uint32_t mask = *waiters;
+
+    *waiters = 0;
+    for (PID = 1; mask; PID++) {
+        if (mask & (1 << PID)) {
+            mask &= ~(1 << PID);
+            task_wake(PID);
+        }
+    }
+}
@@ -0,0 +1,22 @@
+// pipe.h
+
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "types.h"
+#include "filesys.h"
+
+#define MAX_PIPES 8
+#define PIPE_SIZE 4096 // one page of buffer per pipe
+
+// GLOBAL FUNCTIONS
+extern void pipe_dup(file_t* file);
+extern int32_t pipe_open(file_t* file);
+extern int32_t pipe_read(file_t* file, uint8_t* buf, int32_t nbytes);
+extern int32_t pipe_write(file_t* file, uint8_t* buf, int32_t nbytes);
+extern int32_t pipe_close(file_t* file);
+
+// System Calls
+extern int32_t pipe(int32_t* fds);
+
+#endif
@@ -1,42 +1,239 @@
 // pit.c
+// the scheduler clock. The tick source is run one-shot and programmed for the
+// next expiry on the timer wheel. The scheduler quantum is just another wheel
+// timer, only armed while more than one task wants the processor, so an idle
+// system or a single busy terminal takes no ticks. The source is the local
+// APIC timer when there is one (a single register write to arm) and the PIT
+// (mode 0, three port writes) otherwise. Only the boot CPU runs the wheel;
+// the other CPUs take a periodic local APIC tick at the quantum that does
+// nothing but make them look for another task.
 
+#include "pit.h"
 #include "syscalls.h"
 #include "lib.h"
 #include "i8259.h"
+#include "clock.h"
+#include "timer.h"
+#include "vdso.h"
+#include "apic.h"
+#include "smp.h"
 
 // CONSTANTS
 #define DATA_PORT 0x40
 #define COMMAND_PORT 0x43
-#define COUNT 25000
-#define MODE 0x30 // channel 0, lo/hi access, mode 0, 16-bit binary
+#define QUANTUM_MS 20 // scheduler quantum
+#define MODE 0x30 // channel 0, lo/hi access, mode 0 (one-shot), 16-bit binary
+#define MAX_COUNT 0xFFFF // longest one-shot (~55 ms), later deadlines take several
+#define NS_PER_CLOCK 838 // PIT input clock is 1.193182 MHz
+#define MAX_COUNT_NS 54000000
+#define CLOCKS_PER_NS_FRAC 5124677 // 2^32 * 1193182 / 10^9
+#define LAPIC_MAX_NS 1000000000 // longest local APIC timer one-shot we ask for
+#define NS_PER_MS 1000000
+
+// GLOBAL VARIABLES
+static volatile uint8_t tick_armed = 0; // 1 if channel 0 will still fire
+static uint64_t armed_until = 0; // clock_ns() when the armed one-shot goes off
+volatile uint32_t pit_ticks = 0; // number of PIT interrupts taken
+static ktimer_t quantum_timer;
+static volatile uint8_t quantum_over = 0; // set when the quantum runs out
+static uint8_t use_lapic = 0; // 1 if the local APIC timer replaces the PIT
 
 // LOCAL FUNCTION DECLARATIONS
 void set_count(int count);
+static void tick(void);
+static void pit_program(void);
+static void quantum_update(void);
+static void quantum_expired(uint32_t arg);
 
 // GLOBAL FUNCTIONS
+/*
+pit_init
+    DESCRIPTION: picks the tick source, sets up the quantum timer and unmasks
+                 the PIT if it is the one used
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: needs timer_init and smp_init (for the local APIC) first
+*/
 void pit_init(void) {
-    set_count(COUNT);
-    enable_irq(PIT_IRQ_NUM);
+    use_lapic = !lapic_timer_init();
+    timer_setup(&quantum_timer, quantum_expired, 0);
+    pit_update();
+    if (!use_lapic) {
+        enable_irq(PIT_IRQ_NUM);
+    }
 }
 
-void pitHandler(void) {
-    cli();
-    disable_irq(PIT_IRQ_NUM);
+/*
+pit_cpu_init
+    DESCRIPTION: starts the periodic quantum tick of a CPU other than the boot one
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: 0 for success, -1 if there is no local APIC timer to use
+*/
+int32_t pit_cpu_init(void) {
+    if (!use_lapic) {
+        return -1;
+    }
+    lapic_timer_periodic(lapic_timer_khz * QUANTUM_MS);
+    return 0;
+}
 
-    set_count(COUNT);
+/*
+pitHandler
+    DESCRIPTION: called on tick source interrupts (PIT or local APIC timer), runs
+                 the expired wheel timers and re-arms the one-shot for the next
+                 expiry, then asks for a task switch if the quantum ran out or
+                 the processor was idle. On the other CPUs it only asks for a
+                 task switch.
+    INPUTS: frame - unused
+    OUTPUTS: none
+    RETURNS: none
+*/
+void pitHandler(hw_context_t* frame) {
+    uint32_t flags;
 
-    send_eoi(PIT_IRQ_NUM);
-    enable_irq(PIT_IRQ_NUM);
+    if (this_cpu() != 0) {
+        need_resched = 1;
+        return;
+    }
 
-    // make sure the first process has been launched
-    if (CPID != 0) {
-        task_switch();
+    cli_and_save(flags);
+    tick();
+    if (quantum_over || CPID == idle_PID) {
+        quantum_over = 0;
+        need_resched = 1;
     }
+    restore_flags(flags);
+}
 
-    sti();
+/*
+pit_update
+    DESCRIPTION: starts or stops the quantum timer depending on how many tasks
+                 are runnable and moves the one-shot up if a timer was added
+                 that expires sooner. Called whenever a task becomes runnable
+                 or goes to sleep, and after adding a timer. Idle CPUs are
+                 told to look for work, and the boot CPU to re-arm its tick
+                 if this is another one.
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+*/
+void pit_update(void) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    quantum_update();
+    if (this_cpu() == 0) {
+        pit_program();
+    } else {
+        lapic_send_ipi(cpus[0].apic_id, ICR_FIXED | RESCHED_VECTOR);
+    }
+    smp_kick_idle();
+    restore_flags(flags);
 }
 
 // LOCAL FUNCTIONS
+/*
+tick
+    DESCRIPTION: runs the expired wheel timers and re-arms the one-shot
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+static void tick(void) {
+    tick_armed = 0;
+    pit_ticks++;
+    vdso->pit_ticks = pit_ticks;
+    timer_run();
+    quantum_update();
+    pit_program();
+}
+
+/*
+pit_program
+    DESCRIPTION: arms the tick source's one-shot for the next expiry on the timer wheel, unless
+                 the armed one already goes off sooner
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+static void pit_program(void) {
+    uint32_t clocks;
+    uint32_t next;
+    uint32_t ns;
+    uint64_t now = clock_ns();
+    uint64_t deadline;
+
+    // nothing to wait for, leave the tick stopped
+    if (timer_next_expiry(&next)) {
+        return;
+    }
+
+    deadline = (uint64_t)next * TIMER_TICK_NS;
+    if (use_lapic) {
+        if (deadline <= now) {
+            ns = 0;
+        } else if (deadline - now >= LAPIC_MAX_NS) {
+            ns = LAPIC_MAX_NS;
+        } else {
+            ns = (uint32_t)(deadline - now);
+        }
+        clocks = (uint32_t)div64_32((uint64_t)ns * lapic_timer_khz, NS_PER_MS, NULL) + 1;
+    } else {
+        if (deadline <= now) {
+            clocks = 1;
+        } else if (deadline - now >= MAX_COUNT_NS) {
+            clocks = MAX_COUNT;
+        } else {
+            clocks = (uint32_t)(((uint64_t)(uint32_t)(deadline - now) * CLOCKS_PER_NS_FRAC) >> 32) + 1;
+        }
+        ns = clocks * NS_PER_CLOCK;
+    }
+
+    if (!tick_armed || now + ns < armed_until) {
+        if (use_lapic) {
+            lapic_timer_oneshot(clocks);
+        } else {
+            set_count(clocks);
+        }
+        tick_armed = 1;
+        armed_until = now + ns;
+    }
+}
+
+/*
+quantum_update
+    DESCRIPTION: keeps the quantum timer running while tasks have to share the
+                 processor and stops it when they don't
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+static void quantum_update(void) {
+    if (runnable_tasks() > 1) {
+        if (!quantum_timer.pending) {
+            timer_add(&quantum_timer, timer_now() + QUANTUM_MS);
+        }
+    } else {
+        timer_cancel(&quantum_timer);
+    }
+}
+
+/*
+quantum_expired
+    DESCRIPTION: quantum timer action, asks pitHandler to switch tasks
+    INPUTS: arg - unused
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void quantum_expired(uint32_t arg) {
+    quantum_over = 1;
+}
+
 void set_count(int count) {
     outb(MODE, COMMAND_PORT);
 
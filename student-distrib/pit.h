@@ -4,9 +4,14 @@
 #define PIT_H
 
 #include "types.h"
+#include "signal.h"
 
 // GLOBAL FUNCTIONS
 extern void pit_init(void);
-extern void pitHandler(void);
+extern int32_t pit_cpu_init(void);
+extern void pitHandler(hw_context_t* frame);
+extern void pit_update(void);
+
+extern volatile uint32_t pit_ticks;
 
 #endif
@@ -1,31 +1,62 @@
 // rtc.c
-// rtc device driver
+// rtc device driver. Every open of "rtc" gets its own virtual RTC with its own
+// rate and count of ticks not yet read; the chip runs at the fastest rate any
+// of them wants.
 
 #include "rtc.h"
 #include "lib.h"
 #include "i8259.h"
 #include "filesys.h"
 #include "syscalls.h"
+#include "workqueue.h"
+#include "vdso.h"
+#include "idt.h"
 
 // CONSTANTS
 #define RTC_ADDR 0x70 // port for addressing RTC registers and enabling/disabling NMIs
 #define RTC_DATA 0x71 // port for writing data to RTC registers
+#define RTC_REG_A 0x8A // register A (rate select), NMIs disabled
+#define RTC_REG_B 0x8B // register B (interrupt enables), NMIs disabled
+#define RTC_REG_C 0x0C // register C (interrupt flags), reading it acknowledges the chip
+#define RTC_PERIODIC 0x40 // register B periodic interrupt enable
+#define RTC_RATE_1024 6 // register A rate select for 1024 Hz, each step up halves the frequency
 #define MAXIMUM_RTC_RATE 1024
 #define NUM_FREQS 10
+#define MAX_RTC_FILES 16
+
+// one open of the RTC
+typedef struct {
+    uint8_t in_use;
+    uint8_t refs;     // file_t's sharing it (spawn copies descriptors)
+    int32_t freq;     // 0, 2, 4, 8, 16, ..., 1024
+    uint32_t pending; // ticks since the last rtc_read
+    int32_t owner;    // PID that opened it, for the vDSO tick count
+    int32_t waiter;   // PID asleep in rtc_read, -1 if none
+    int32_t next;     // next file on the same frequency list
+} rtc_file_t;
 
 // GLOBAL VARIABLES
-int active_freq[MAX_PROCESSES + 1]; // frequency that each process wishes to be notified at (0, 2, 4, 8, 16, ..., 1024)
-volatile int8_t interrupt_flag[MAX_PROCESSES + 1];
-int count = 0; // used to keep track of lower frequencies from the base frequency of 1024
+static rtc_file_t rtc_files[MAX_RTC_FILES];
+int count = 0; // 1024 Hz ticks, advanced by as many as each interrupt is worth at the programmed rate
+static int32_t subscribers[NUM_FREQS]; // first file listening to 1024 >> i, -1 if none
+static uint32_t shift = 0; // the chip runs at 1024 >> shift Hz while any list is non-empty
+static uint32_t bottom_half_count = 0; // count as of the last rtc_bottom_half
 
 // FUNCTION DECLARATIONS
 void rtc_init();
-void rtcHandler();
+void rtcHandler(hw_context_t* frame);
+void rtc_bottom_half(uint32_t new_count);
+void rtc_dup(file_t* file);
+static void subscribe(int32_t idx, int32_t freq);
+static void unsubscribe(int32_t idx);
+static void program_rate(void);
+static int32_t freq_index(int32_t freq);
 
 // GLOBAL FUNCTIONS
 /*
 rtc_init
-    DESCRIPTION: initializes the rtc chip
+    DESCRIPTION: initializes the rtc chip with periodic interrupts off, they are
+                 turned on when a process sets a rate
     INPUTS: none
     OUTPUTS: none
     RETURNS: none
@@ -34,108 +65,172 @@ NOTES: important that interrupts are disabled when calling this function
 void rtc_init(void) {
     // zero global vars
     int i;
-    for (i = 0; i < MAX_PROCESSES + 1; i++) {
-        active_freq[i] = 0;
-        interrupt_flag[i] = 0;
+    for (i = 0; i < MAX_RTC_FILES; i++) {
+        rtc_files[i].in_use = 0;
+    }
+    for (i = 0; i < NUM_FREQS; i++) {
+        subscribers[i] = -1;
     }
 
     // initialize rtc chip
-    outb(0x8B, RTC_ADDR); // address register 0x0B and disable NMIs (0x80)
+    outb(RTC_REG_B, RTC_ADDR); // address register 0x0B and disable NMIs (0x80)
     uint8_t  temp = inb(RTC_DATA); // read register 0x0B
-    outb(0x8B, RTC_ADDR); // address register again because apparently reading resets this
-    outb(temp | 0x40, RTC_DATA); // turns on periodic interrupts at 1024hz
+    outb(RTC_REG_B, RTC_ADDR); // address register again because apparently reading resets this
+    outb(temp & ~RTC_PERIODIC, RTC_DATA); // periodic interrupts off until somebody listens
     enable_irq(RTC_IRQ_NUM);
 }
 
 
 /*
 rtcHandler
-    DESCRIPTION: called on RTC interrupts
-    INPUTS: none
+    DESCRIPTION: called on RTC interrupts, acknowledges the chip and leaves
+                 waking the listeners to rtc_bottom_half
+    INPUTS: frame - unused
     OUTPUTS: none
     RETURNS: none
-    NOTES: important that interrupts are disabled when calling this function
+    NOTES: runs with interrupts on and the RTC line masked, so count is only
+           written here
 */
-void rtcHandler(void) {
-    cli();
-    disable_irq(RTC_IRQ_NUM);
+void rtcHandler(hw_context_t* frame) {
+    uint32_t flags;
 
-    outb(0x0C, RTC_ADDR); // select register 0x0C
+    // the index and data ports are a pair, keep other handlers off them
+    cli_and_save(flags);
+    outb(RTC_REG_C, RTC_ADDR); // select register 0x0C
     inb(RTC_DATA); // throw away contents (important)
+    restore_flags(flags);
+
+    count += 1 << shift;
+    vdso->rtc_irq_tsc = (uint32_t)interrupt_entry_tsc();
+    vdso->rtc_count = count;
+
+    schedule_work(rtc_bottom_half, count);
+}
+
+/*
+rtc_bottom_half
+    DESCRIPTION: adds a tick to the files listening to each frequency that ticked
+                 and wakes their readers, runs in the worker thread
+    INPUTS: value of count after the interrupt
+    OUTPUTS: none
+    RETURNS: none
+*/
+void rtc_bottom_half(uint32_t new_count) {
+    // count is in 1024 Hz ticks, so 1024 >> i Hz ticked if bit i or anything
+    // above it changed. Only the lists for those frequencies are walked.
+    uint32_t old_count = bottom_half_count;
+    uint32_t flags;
+    int32_t i, j;
 
-    // this method utilizes binary counting
-    // by increasing count on every interrupt, the least significant bit will change every interrupt
-    // the second to least significant bit, however, will only change every other interrupt
-    // etc.
-    int old_count = count;
-    count++;
-    int mask = 0x00000001;
-    int i, j;
-    // iterate through each frequency
+    bottom_half_count = new_count;
+    cli_and_save(flags);
     for (i = 0; i < NUM_FREQS; i++) {
-        // check if the corresponding bit has changed
-        if ((old_count & mask) != (count & mask)) {
-            // look for processes that are listening to that frequency
-            for (j = 0; j < MAX_PROCESSES + 1; j++) {
-                if (active_freq[j] == (MAXIMUM_RTC_RATE >> i)) {
-                    interrupt_flag[j] = 1;
+        if ((old_count >> i) != (new_count >> i)) {
+            for (j = subscribers[i]; j != -1; j = rtc_files[j].next) {
+                rtc_files[j].pending++;
+                vdso->rtc_ticks[rtc_files[j].owner]++;
+                if (rtc_files[j].waiter != -1) {
+                    task_wake(rtc_files[j].waiter);
                 }
             }
         }
-        mask = mask << 1;
     }
-
-    send_eoi(RTC_IRQ_NUM);
-    enable_irq(RTC_IRQ_NUM);
-    sti();
+    restore_flags(flags);
 }
 
 /*
  * rtc_open
- * DESCRIPTION: Opens the RTC driver stream
- * INPUTS: none
+ * DESCRIPTION: Opens a virtual RTC, silent until a rate is written to it
+ * INPUTS: file - the new descriptor
+ * OUTPUTS: file->inode is the virtual RTC
+ * RETURNS: 0 on success, -1 if too many are open
+ */
+int32_t rtc_open(file_t* file)
+{
+    uint32_t flags;
+    int32_t i;
+
+    cli_and_save(flags);
+    for (i = 0; i < MAX_RTC_FILES; i++) {
+        if (!rtc_files[i].in_use) {
+            rtc_files[i].in_use = 1;
+            rtc_files[i].refs = 1;
+            rtc_files[i].freq = 0;
+            rtc_files[i].pending = 0;
+            rtc_files[i].owner = CPID;
+            rtc_files[i].waiter = -1;
+            rtc_files[i].next = -1;
+            file->inode = i;
+            restore_flags(flags);
+            return 0;
+        }
+    }
+    restore_flags(flags);
+    return -1;
+}
+
+/*
+ * rtc_dup
+ * DESCRIPTION: notes that another descriptor refers to the same virtual RTC
+ * INPUTS: file - copy of an RTC descriptor, anything else is ignored
  * OUTPUTS: none
- * RETURNS: 0
+ * RETURNS: none
  */
-int32_t rtc_open()
+void rtc_dup(file_t* file)
 {
-    return 0;
+    if (file->jumptable->open == rtc_open) {
+        rtc_files[file->inode].refs++;
+    }
 }
 
 /*
  * rtc_read
- * DESCRIPTION: Reads from the RTC driver
- * INPUTS: file    - not used
- *         buf    - not used
- *         nbytes - not used
- * OUTPUTS: none
- * RETURNS: nbytes on success, -1 if read not successful.
+ * DESCRIPTION: Waits for the next tick at the rate set on this descriptor
+ * INPUTS: file    - the virtual RTC
+ *         buf    - where to store the ticks since the last read (uint32_t),
+ *                  more than one if the caller fell behind; may be too short
+ *                  to hold it if the caller doesn't care
+ *         nbytes - size of buf
+ * OUTPUTS: the tick count
+ * RETURNS: nbytes on success, 0 if no rate is set
  * NOTES:
  */
 int32_t rtc_read(file_t * file, uint8_t *buf, int32_t nbytes)
 {
-    if (!active_freq[CPID]) {
+    rtc_file_t* rtc = &rtc_files[file->inode];
+    uint32_t ticks;
+
+    if (!rtc->freq) {
         return 0;
     }
 
-    while(!interrupt_flag[CPID]) {
-        sti();
+    cli();
+    while(!rtc->pending) {
+        rtc->waiter = CPID;
+        task_sleep();
+        cli();
     }
 
-    interrupt_flag[CPID] = 0;
+    rtc->waiter = -1;
+    ticks = rtc->pending;
+    rtc->pending = 0;
+    sti();
 
+    if (buf != NULL && nbytes >= (int32_t)sizeof(uint32_t)) {
+        *(uint32_t*)buf = ticks;
+    }
     return nbytes;
 }
 
 /*
  * rtc_write
- * DESCRIPTION: Sets the interrupt frequency to a specified rate
- * INPUTS: file    - not used
+ * DESCRIPTION: Sets the interrupt frequency of this descriptor
+ * INPUTS: file    - the virtual RTC
  *         buf    - The new rate to set the RTC Periodic Interrupt to
  *         nbytes - The number of bytes to write, not used.
  * OUTPUTS: none
  * RETURNS: nbytes on success. -1 if it fails.
- * NOTES:
+ * NOTES: drops ticks not yet read
  */
 int32_t rtc_write(file_t * file, uint8_t *buf, int32_t nbytes)
 {
@@ -148,20 +243,132 @@ int32_t rtc_write(file_t * file, uint8_t *buf, int32_t nbytes)
         return -1;
     }
 
-    active_freq[CPID] = rate;
+    subscribe(file->inode, rate);
+    vdso->rtc_ticks[CPID] = 0;
 
     return nbytes;
 }
 
 /*
  * rtc_close
- * DESCRIPTION: closes rtc
- * INPUTS: file - not used
+ * DESCRIPTION: closes a descriptor, the virtual RTC goes away with the last one
+ * INPUTS: file - the virtual RTC
  * OUTPUTS: none
  * RETURNS: 0
  */
 int32_t rtc_close(file_t* file)
 {
-    active_freq[CPID] = 0;
+    uint32_t flags;
+    rtc_file_t* rtc = &rtc_files[file->inode];
+
+    cli_and_save(flags);
+    if (--rtc->refs == 0) {
+        subscribe(file->inode, 0);
+        rtc->in_use = 0;
+    }
+    restore_flags(flags);
     return 0;
 }
+
+// LOCAL FUNCTIONS
+/*
+subscribe
+    DESCRIPTION: moves a virtual RTC to the list of the frequency it asked for
+                 and reprograms the chip for the fastest one still wanted
+    INPUTS: idx - the virtual RTC
+            freq - 2 to 1024, or 0 to stop ticking
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void subscribe(int32_t idx, int32_t freq) {
+    uint32_t flags;
+    int32_t i;
+
+    cli_and_save(flags);
+    unsubscribe(idx);
+    rtc_files[idx].freq = freq;
+    rtc_files[idx].pending = 0;
+    if (freq) {
+        i = freq_index(freq);
+        rtc_files[idx].next = subscribers[i];
+        subscribers[i] = idx;
+    }
+    program_rate();
+    restore_flags(flags);
+}
+
+/*
+unsubscribe
+    DESCRIPTION: takes a virtual RTC off its frequency's list
+    INPUTS: idx - the virtual RTC
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+static void unsubscribe(int32_t idx) {
+    int32_t* link;
+
+    if (!rtc_files[idx].freq) {
+        return;
+    }
+    for (link = &subscribers[freq_index(rtc_files[idx].freq)]; *link != -1; link = &rtc_files[*link].next) {
+        if (*link == idx) {
+            *link = rtc_files[idx].next;
+            break;
+        }
+    }
+    rtc_files[idx].next = -1;
+}
+
+/*
+program_rate
+    DESCRIPTION: runs the chip at the highest frequency anybody listens to,
+                 or turns periodic interrupts off if nobody does
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+static void program_rate(void) {
+    uint8_t reg;
+    int32_t i;
+
+    for (i = 0; i < NUM_FREQS && subscribers[i] == -1; i++);
+
+    outb(RTC_REG_B, RTC_ADDR);
+    reg = inb(RTC_DATA);
+    if (i == NUM_FREQS) {
+        outb(RTC_REG_B, RTC_ADDR);
+        outb(reg & ~RTC_PERIODIC, RTC_DATA);
+        return;
+    }
+
+    shift = i;
+    outb(RTC_REG_A, RTC_ADDR);
+    reg = inb(RTC_DATA);
+    outb(RTC_REG_A, RTC_ADDR);
+    outb((reg & 0xF0) | (RTC_RATE_1024 + i), RTC_DATA);
+
+    outb(RTC_REG_B, RTC_ADDR);
+    reg = inb(RTC_DATA);
+    if (!(reg & RTC_PERIODIC)) {
+        outb(RTC_REG_B, RTC_ADDR);
+        outb(reg | RTC_PERIODIC, RTC_DATA);
+        outb(RTC_REG_C, RTC_ADDR); // drop a flag left from before
+        inb(RTC_DATA);
+    }
+}
+
+/*
+freq_index
+    DESCRIPTION: list index of a frequency
+    INPUTS: freq - power of two from 2 to 1024
+    OUTPUTS: none
+    RETURNS: i such that freq == 1024 >> i
+*/
+static int32_t freq_index(int32_t freq) {
+    int32_t i;
+
+    for (i = 0; (MAXIMUM_RTC_RATE >> i) != freq; i++);
+    return i;
+}
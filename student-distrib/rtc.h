@@ -6,11 +6,13 @@
 
 #include "types.h"
 #include "filesys.h"
+#include "signal.h"
 
 extern void rtc_init();
-extern void rtcHandler();
+extern void rtcHandler(hw_context_t* frame);
 
-extern int32_t rtc_open();
+extern int32_t rtc_open(file_t* file);
+extern void rtc_dup(file_t* file);
 extern int32_t rtc_read(file_t * file, uint8_t * buf, int32_t nbytes);
 extern int32_t rtc_write(file_t * file, uint8_t * buf, int32_t nbytes);
 extern int32_t rtc_close(file_t * file);
@@ -0,0 +1,251 @@
+// shm.c
+// named shared memory. A segment is a set of 4 KB pages from the frame
+// allocator; every process that attaches it maps the same pages somewhere in
+// its SHM_WINDOW, so data written by one is seen by the others without a
+// copy. A segment is freed when the last process detaches from it, or, if
+// nobody ever attached it, when the last process to shm_create it halts.
+
+#include "shm.h"
+#include "syscalls.h"
+#include "paging.h"
+#include "frame.h"
+#include "lib.h"
+
+// CONSTANTS
+#define PAGE_SIZE 4096
+
+typedef struct {
+    int8_t name[SHM_NAME_LEN];
+    uint32_t pages[SHM_MAX_PAGES]; // physical addresses from page_alloc
+    uint32_t npages;
+    uint32_t attached; // number of attachments across all processes
+    uint32_t creator;  // last PID to shm_create it, frees it on halt if unattached
+    uint8_t zeroed;    // cleared through the first attachment, the kernel doesn't map the pages itself
+    uint8_t in_use;
+} shm_segment_t;
+
+typedef struct {
+    uint32_t addr;
+    int32_t seg;
+    uint8_t in_use;
+} shm_attachment_t;
+
+// GLOBAL VARIABLES
+static shm_segment_t segments[SHM_SEGMENTS];
+static shm_attachment_t attachments[MAX_PROCESSES + 1][SHM_MAX_ATTACH]; // indexed by PID
+
+// FUNCTION DECLARATIONS
+int32_t shm_create(const int8_t* name, uint32_t size);
+int32_t shm_attach(int32_t id, void* addr);
+int32_t shm_detach(void* addr);
+void shm_task_exit(uint32_t PID);
+static int32_t find_attachment(uint32_t PID, uint32_t addr);
+static void detach(uint32_t PID, int32_t slot);
+static void free_segment(shm_segment_t* seg);
+
+// GLOBAL FUNCTIONS
+/*
+ * shm_create
+ *   DESCRIPTION:  finds the segment with the given name, or makes a new one,
+ *                 which reads as zeroes once attached
+ *   INPUTS:       name - name of the segment
+ *                 size - size in bytes, rounded up to whole pages
+ *   OUTPUTS:      none
+ *   RETURN VALUE: segment id, -1 if there is no slot or memory, or an existing
+ *                 segment is too small
+ *   SIDE EFFECTS: none
+ */
+int32_t shm_create(const int8_t* name, uint32_t size) {
+    uint32_t npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t len, i;
+    int32_t id, free_id = -1;
+
+    if (name == NULL || !user_range_ok((uint32_t) name, 1)) {
+        return -1;
+    }
+    for (len = 0; len < SHM_NAME_LEN && user_range_ok((uint32_t) (name + len), 1) && name[len] != '\0'; len++);
+    if (len == 0 || len >= SHM_NAME_LEN || !user_range_ok((uint32_t) (name + len), 1)) {
+        return -1;
+    }
+    if (npages == 0 || npages > SHM_MAX_PAGES) {
+        return -1;
+    }
+
+    for (id = 0; id < SHM_SEGMENTS; id++) {
+        if (!segments[id].in_use) {
+            if (free_id < 0) {
+                free_id = id;
+            }
+        } else if (!strncmp(segments[id].name, name, SHM_NAME_LEN)) {
+            if (npages > segments[id].npages) {
+                return -1;
+            }
+            segments[id].creator = CPID;
+            return id;
+        }
+    }
+    if (free_id < 0) {
+        return -1;
+    }
+
+    id = free_id;
+    for (i = 0; i < npages; i++) {
+        if (!(segments[id].pages[i] = page_alloc())) {
+            while (i-- > 0) {
+                page_free(segments[id].pages[i]);
+            }
+            return -1;
+        }
+    }
+
+    strncpy(segments[id].name, name, SHM_NAME_LEN);
+    segments[id].npages = npages;
+    segments[id].attached = 0;
+    segments[id].creator = CPID;
+    segments[id].zeroed = 0;
+    segments[id].in_use = 1;
+    return id;
+}
+
+/*
+ * shm_attach
+ *   DESCRIPTION:  maps a segment into the calling process
+ *   INPUTS:       id - segment from shm_create
+ *                 addr - 4 KB aligned address inside SHM_WINDOW
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 0 if successful, -1 if not
+ *   SIDE EFFECTS: changes the process's page tables
+ */
+int32_t shm_attach(int32_t id, void* addr) {
+    uint32_t base = (uint32_t) addr;
+    uint32_t i;
+    int32_t slot;
+
+    if (id < 0 || id >= SHM_SEGMENTS || !segments[id].in_use) {
+        return -1;
+    }
+    if ((base & (PAGE_SIZE - 1)) || base < SHM_WINDOW ||
+        base + segments[id].npages * PAGE_SIZE > SHM_WINDOW + FOUR_MB) {
+        return -1;
+    }
+
+    for (slot = 0; slot < SHM_MAX_ATTACH && attachments[CPID][slot].in_use; slot++);
+    if (slot == SHM_MAX_ATTACH) {
+        return -1;
+    }
+
+    for (i = 0; i < segments[id].npages; i++) {
+        if (map_shared_page(CPID, base + i * PAGE_SIZE, segments[id].pages[i])) {
+            // overlaps something already attached, back out
+            while (i-- > 0) {
+                unmap_shared_page(CPID, base + i * PAGE_SIZE);
+            }
+            return -1;
+        }
+    }
+
+    if (!segments[id].zeroed) {
+        memset((void*) base, 0, segments[id].npages * PAGE_SIZE);
+        segments[id].zeroed = 1;
+    }
+
+    attachments[CPID][slot].addr = base;
+    attachments[CPID][slot].seg = id;
+    attachments[CPID][slot].in_use = 1;
+    segments[id].attached++;
+    return 0;
+}
+
+/*
+ * shm_detach
+ *   DESCRIPTION:  unmaps a segment attached at addr
+ *   INPUTS:       addr - address passed to shm_attach
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 0 if successful, -1 if nothing is attached there
+ *   SIDE EFFECTS: changes the process's page tables, may free the segment
+ */
+int32_t shm_detach(void* addr) {
+    int32_t slot = find_attachment(CPID, (uint32_t) addr);
+
+    if (slot < 0) {
+        return -1;
+    }
+    detach(CPID, slot);
+    return 0;
+}
+
+/*
+ * shm_task_exit
+ *   DESCRIPTION:  detaches everything a halting process still has attached
+ *                 and frees the segments it created that nobody attached
+ *   INPUTS:       PID of the process
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may free segments
+ */
+void shm_task_exit(uint32_t PID) {
+    int32_t slot, id;
+
+    for (slot = 0; slot < SHM_MAX_ATTACH; slot++) {
+        if (attachments[PID][slot].in_use) {
+            detach(PID, slot);
+        }
+    }
+    for (id = 0; id < SHM_SEGMENTS; id++) {
+        if (segments[id].in_use && segments[id].attached == 0 && segments[id].creator == PID) {
+            free_segment(&segments[id]);
+        }
+    }
+}
+
+// LOCAL FUNCTIONS
+static int32_t find_attachment(uint32_t PID, uint32_t addr) {
+    int32_t slot;
+
+    for (slot = 0; slot < SHM_MAX_ATTACH; slot++) {
+        if (attachments[PID][slot].in_use && attachments[PID][slot].addr == addr) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/*
+ * detach
+ *   DESCRIPTION:  unmaps one attachment and drops the segment's count,
+ *                 freeing its frames if it was the last one
+ *   INPUTS:       PID - process, slot - its attachment
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void detach(uint32_t PID, int32_t slot) {
+    shm_segment_t* seg = &segments[attachments[PID][slot].seg];
+    uint32_t i;
+
+    for (i = 0; i < seg->npages; i++) {
+        unmap_shared_page(PID, attachments[PID][slot].addr + i * PAGE_SIZE);
+    }
+    attachments[PID][slot].in_use = 0;
+
+    if (--seg->attached == 0) {
+        free_segment(seg);
+    }
+}
+
+/*
+ * free_segment
+ *   DESCRIPTION:  gives a segment's frames and slot back
+ *   INPUTS:       seg - segment nobody has attached
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void free_segment(shm_segment_t* seg) {
+    uint32_t i;
+
+    for (i = 0; i < seg->npages; i++) {
+        page_free(seg->pages[i]);
+    }
+    seg->in_use = 0;
+}
@@ -0,0 +1,21 @@
+// shm.h
+
+#ifndef SHM_H
+#define SHM_H
+
+#include "types.h"
+
+#define SHM_MAX_PAGES  1024 // 4 KB pages per segment, enough to fill SHM_WINDOW
+#define SHM_SEGMENTS   8
+#define SHM_NAME_LEN   32
+#define SHM_MAX_ATTACH 8  // per process
+
+// GLOBAL FUNCTIONS
+extern void shm_task_exit(uint32_t PID);
+
+// System Calls
+extern int32_t shm_create(const int8_t* name, uint32_t size);
+extern int32_t shm_attach(int32_t id, void* addr);
+extern int32_t shm_detach(void* addr);
+
+#endif
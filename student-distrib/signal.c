@@ -0,0 +1,263 @@
+// signal.c
+// signal delivery. Signals are marked pending on the process and delivered by
+// do_signal on the way back to user space, which points the saved frame at the
+// handler and leaves a copy of the interrupted registers on the user stack for
+// sigreturn to put back. Signals without a handler are left to the sender's
+// default action.
+
+#include "signal.h"
+#include "syscalls.h"
+#include "paging.h"
+#include "timer.h"
+#include "pit.h"
+#include "futex.h"
+#include "x86_desc.h"
+#include "lib.h"
+
+// CONSTANTS
+#define SYS_SIGRETURN   10
+#define TRAMPOLINE_SIZE 8          // movl $SYS_SIGRETURN, %eax; int $0x80; padded
+#define USER_EFLAGS     0x00000DD5 // CF PF AF ZF SF TF DF OF, the flags sigreturn may change
+#define EFLAGS_IF       0x00000200
+
+// FUNCTION DECLARATIONS
+void signal_task_init(uint32_t PID);
+void signal_task_exit(uint32_t PID);
+int32_t signal_send(uint32_t PID, uint32_t signum);
+int32_t signal_pending(uint32_t PID);
+int32_t signal_exception(hw_context_t* frame, uint32_t signum);
+void do_signal(hw_context_t* frame);
+int32_t set_handler(int32_t signum, void* handler_address);
+int32_t sigreturn(int32_t unused1, int32_t unused2, int32_t unused3, hw_context_t* frame);
+static void alarm_fire(uint32_t PID);
+
+// GLOBAL FUNCTIONS
+/*
+signal_task_init
+    DESCRIPTION: resets a new process to no handlers and nothing pending
+    INPUTS: PID of the process
+    OUTPUTS: none
+    RETURNS: none
+*/
+void signal_task_init(uint32_t PID) {
+    int i;
+    for (i = 0; i < NUM_SIGNALS; i++) {
+        processes[PID].sig_handlers[i] = NULL;
+    }
+    processes[PID].sig_pending = 0;
+    processes[PID].sig_masked = 0;
+    timer_setup(&processes[PID].alarm_timer, alarm_fire, PID);
+}
+
+/*
+signal_task_exit
+    DESCRIPTION: stops the alarm of a process that is going away
+    INPUTS: PID of the process
+    OUTPUTS: none
+    RETURNS: none
+*/
+void signal_task_exit(uint32_t PID) {
+    timer_cancel(&processes[PID].alarm_timer);
+    processes[PID].sig_pending = 0;
+}
+
+/*
+signal_send
+    DESCRIPTION: queues a signal for a process that has a handler for it. A
+                 process sleeping in nanosleep is woken up early.
+    INPUTS: PID - the process
+            signum - the signal
+    OUTPUTS: none
+    RETURNS: 0 if queued, -1 if the process has no handler (the caller applies
+             the default action)
+    NOTES: never switches tasks, safe from timer callbacks
+*/
+int32_t signal_send(uint32_t PID, uint32_t signum) {
+    uint32_t flags;
+
+    if (PID == 0 || PID > MAX_PROCESSES || signum >= NUM_SIGNALS) {
+        return -1;
+    }
+    if (!processes[PID].running || processes[PID].sig_handlers[signum] == NULL) {
+        return -1;
+    }
+
+    cli_and_save(flags);
+    processes[PID].sig_pending |= 1 << signum;
+    if (processes[PID].sleep_timer.pending || futex_waiting(PID)) {
+        processes[PID].sleeping = 0;
+        pit_update();
+    }
+    restore_flags(flags);
+    return 0;
+}
+
+/*
+signal_pending
+    DESCRIPTION: checks whether a process has a signal waiting for delivery
+    INPUTS: PID of the process
+    OUTPUTS: none
+    RETURNS: nonzero if it does
+*/
+int32_t signal_pending(uint32_t PID) {
+    return processes[PID].sig_pending && !processes[PID].sig_masked;
+}
+
+/*
+signal_exception
+    DESCRIPTION: turns an exception in user code into a signal, called by the
+                 exception handlers before they fall back to killing the process
+    INPUTS: frame - registers at the exception
+            signum - DIV_ZERO or SEGFAULT
+    OUTPUTS: none
+    RETURNS: 1 if the signal will be delivered on return, 0 if the process has
+             to die (kernel fault, no handler, or faulting inside a handler)
+*/
+int32_t signal_exception(hw_context_t* frame, uint32_t signum) {
+    if ((frame->cs & 3) != 3 || processes[CPID].sig_masked) {
+        return 0;
+    }
+    return signal_send(CPID, signum) == 0;
+}
+
+/*
+do_signal
+    DESCRIPTION: called by every wrapper right before returning to the
+                 interrupted code. If that is user code with a signal pending,
+                 builds a signal frame on the user stack and points the saved
+                 registers at the handler.
+                 User stack after this (low to high): return address into the
+                 trampoline, signum, hw_context_t, trampoline code.
+    INPUTS: frame - registers that are about to be restored
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+void do_signal(hw_context_t* frame) {
+    pcb_t* p = &processes[CPID];
+    uint32_t signum, esp, trampoline;
+
+    if ((frame->cs & 3) != 3 || p->kthread || !signal_pending(CPID)) {
+        return;
+    }
+
+    for (signum = 0; signum < NUM_SIGNALS; signum++) {
+        if (p->sig_pending & (1 << signum)) {
+            break;
+        }
+    }
+    p->sig_pending &= ~(1 << signum);
+
+    // handler was removed after the signal was sent
+    if (p->sig_handlers[signum] == NULL) {
+        return;
+    }
+
+    esp = frame->esp - TRAMPOLINE_SIZE - sizeof(hw_context_t) - 2 * sizeof(uint32_t);
+    if (!user_range_ok(esp, frame->esp - esp)) {
+        exception_halt();
+    }
+
+    // movl $SYS_SIGRETURN, %eax; int $0x80
+    trampoline = frame->esp - TRAMPOLINE_SIZE;
+    ((uint8_t*) trampoline)[0] = 0xB8;
+    *(uint32_t*)(trampoline + 1) = SYS_SIGRETURN;
+    ((uint8_t*) trampoline)[5] = 0xCD;
+    ((uint8_t*) trampoline)[6] = 0x80;
+    ((uint8_t*) trampoline)[7] = 0x90;
+
+    memcpy((void*)(trampoline - sizeof(hw_context_t)), frame, sizeof(hw_context_t));
+    ((uint32_t*) esp)[1] = signum;
+    ((uint32_t*) esp)[0] = trampoline;
+
+    frame->esp = esp;
+    frame->eip = (uint32_t) p->sig_handlers[signum];
+    p->sig_masked = 1;
+}
+
+/*
+ * set_handler
+ *   DESCRIPTION:  installs a user function as the handler for a signal, or goes
+ *                 back to the default action. Installing an ALARM handler starts
+ *                 the process's alarm.
+ *   INPUTS:       signum - the signal
+ *                 handler_address - void handler(int signum), NULL for default
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 0 if successful, -1 if not
+ *   SIDE EFFECTS: none
+ */
+int32_t set_handler(int32_t signum, void* handler_address) {
+    pcb_t* p = &processes[CPID];
+
+    if (signum < 0 || signum >= NUM_SIGNALS) {
+        return -1;
+    }
+    if (handler_address != NULL && !user_range_ok((uint32_t) handler_address, 1)) {
+        return -1;
+    }
+
+    p->sig_handlers[signum] = handler_address;
+
+    if (signum == ALARM) {
+        if (handler_address == NULL) {
+            timer_cancel(&p->alarm_timer);
+        } else if (!p->alarm_timer.pending) {
+            timer_add(&p->alarm_timer, timer_now() + ALARM_MS);
+            pit_update();
+        }
+    }
+    return 0;
+}
+
+/*
+ * sigreturn
+ *   DESCRIPTION:  called by the trampoline when a handler returns, copies the
+ *                 registers saved by do_signal (possibly changed by the handler)
+ *                 back into the frame the process returns through. Segments and
+ *                 privileged flags are not taken from user memory.
+ *   INPUTS:       frame - registers of the sigreturn call, passed by the wrapper
+ *   OUTPUTS:      none
+ *   RETURN VALUE: the restored EAX, so the wrapper's store keeps it
+ *   SIDE EFFECTS: unmasks signals
+ */
+int32_t sigreturn(int32_t unused1, int32_t unused2, int32_t unused3, hw_context_t* frame) {
+    pcb_t* p = &processes[CPID];
+    hw_context_t* saved;
+
+    if (!p->sig_masked) {
+        return -1;
+    }
+
+    // the handler's return popped the trampoline address, signum is at esp
+    saved = (hw_context_t*)(frame->esp + sizeof(uint32_t));
+    if (!user_range_ok((uint32_t) saved, sizeof(hw_context_t))) {
+        return -1;
+    }
+
+    frame->ebx = saved->ebx;
+    frame->ecx = saved->ecx;
+    frame->edx = saved->edx;
+    frame->esi = saved->esi;
+    frame->edi = saved->edi;
+    frame->ebp = saved->ebp;
+    frame->eip = saved->eip;
+    frame->esp = saved->esp;
+    frame->eflags = (frame->eflags & ~USER_EFLAGS) | (saved->eflags & USER_EFLAGS) | EFLAGS_IF;
+
+    p->sig_masked = 0;
+    return saved->eax;
+}
+
+// LOCAL FUNCTIONS
+/*
+alarm_fire
+    DESCRIPTION: alarm timer action, signals the process and re-arms
+    INPUTS: PID of the process
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void alarm_fire(uint32_t PID) {
+    if (signal_send(PID, ALARM) == 0) {
+        timer_add(&processes[PID].alarm_timer, timer_now() + ALARM_MS);
+    }
+}
@@ -0,0 +1,55 @@
+// signal.h
+
+#ifndef SIGNAL_H
+#define SIGNAL_H
+
+#include "types.h"
+
+#define DIV_ZERO    0 // divide error in user code, default: kill
+#define SEGFAULT    1 // any other exception in user code, default: kill
+#define INTERRUPT   2 // ctrl-c, default: kill
+#define ALARM       3 // every ALARM_MS, default: ignore
+#define USER1       4 // default: ignore
+#define NUM_SIGNALS 5
+
+#define ALARM_MS 10000
+
+/*
+ * Register frame at the top of the kernel stack on every way in from user space
+ * (interrupts, exceptions, int 0x80 and sysenter), built by SAVE_ALL in
+ * int_wrapper.h on top of what the processor pushed. The same layout is copied
+ * onto the user stack under a signal handler's argument.
+ */
+typedef struct {
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t ebp;
+    uint32_t eax;
+    uint32_t ds;
+    uint32_t es;
+    uint32_t fs;
+    uint32_t irq_num;  // vector, 0x80 for system calls
+    uint32_t err_code; // processor error code, system call number for system calls
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t esp;      // only valid when coming from user space
+    uint32_t ss;
+} hw_context_t;
+
+// GLOBAL FUNCTIONS
+extern void signal_task_init(uint32_t PID);
+extern void signal_task_exit(uint32_t PID);
+extern int32_t signal_send(uint32_t PID, uint32_t signum);
+extern int32_t signal_pending(uint32_t PID);
+extern int32_t signal_exception(hw_context_t* frame, uint32_t signum);
+extern void do_signal(hw_context_t* frame);
+
+// System Calls
+extern int32_t set_handler(int32_t signum, void* handler_address);
+extern int32_t sigreturn(int32_t unused1, int32_t unused2, int32_t unused3, hw_context_t* frame);
+
+#endif
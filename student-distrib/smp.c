@@ -0,0 +1,544 @@
+// smp.c
+// multiprocessor bring-up. The MP configuration table left by the BIOS lists
+// the CPUs and the IO-APIC; every CPU but the boot one is started with
+// INIT-SIPI-SIPI and the ISA IRQs are moved from the 8259s to the IO-APIC.
+//
+// Each CPU has its own TSS, running task (CPID), idle thread and loaded page
+// directory; the task table is the one run queue they all pick from. The
+// rest of the kernel was written for one processor with cli/sti critical
+// sections, so it is guarded by a single kernel lock: a CPU takes it on every
+// way into the kernel and drops it on the way back to user space (or when its
+// idle thread halts). Kernel code thus never runs on two CPUs at once and
+// cli/sti keep meaning what they did, while user code runs on all of them.
+// Other CPUs are told about new work with a reschedule IPI and about page
+// table changes with a TLB flush IPI, which is answered without the lock.
+
+#include "smp.h"
+#include "apic.h"
+#include "paging.h"
+#include "clock.h"
+#include "i8259.h"
+#include "x86_desc.h"
+#include "syscalls.h"
+#include "idt.h"
+#include "pit.h"
+#include "lib.h"
+
+// CONSTANTS
+#define MP_FLOAT_SIG     0x5f504d5f // "_MP_"
+#define MP_CONFIG_SIG    0x504d4350 // "PCMP"
+#define MP_PROCESSOR     0
+#define MP_BUS           1
+#define MP_IOAPIC        2
+#define MP_IOINT         3
+#define MP_LOCALINT      4
+#define MP_CPU_ENABLED   0x01
+#define MP_CPU_BSP       0x02
+#define MP_IOAPIC_USABLE 0x01
+#define MP_INT_VECTORED  0          // plain interrupt (not NMI/SMI/ExtINT)
+#define MAX_BUSES        32
+#define INIT_DELAY_US    10000
+#define SIPI_DELAY_US    200
+#define AP_WAIT_US       100000     // how long a CPU gets to check in
+
+// the floating pointer structure that leads to the configuration table
+typedef struct {
+    uint32_t signature;
+    uint32_t config;   // physical address of mp_config_t
+    uint8_t length;    // in 16 byte units
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed)) mp_float_t;
+
+typedef struct {
+    uint32_t signature;
+    uint16_t length;   // of the base table, entries included
+    uint8_t revision;
+    uint8_t checksum;
+    int8_t oem[20];
+    uint32_t oem_table;
+    uint16_t oem_length;
+    uint16_t entries;
+    uint32_t lapic;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} __attribute__((packed)) mp_config_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__((packed)) mp_processor_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t id;
+    int8_t name[6];    // "ISA   ", "PCI   ", ...
+} __attribute__((packed)) mp_bus_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t id;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t addr;
+} __attribute__((packed)) mp_ioapic_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t int_type;
+    uint16_t flags;
+    uint8_t src_bus;
+    uint8_t src_irq;
+    uint8_t dst_ioapic;
+    uint8_t dst_pin;
+} __attribute__((packed)) mp_ioint_t;
+
+// GLOBAL VARIABLES
+cpu_t cpus[MAX_CPUS];             // the boot CPU is cpus[0]
+uint32_t num_cpus = 1;
+volatile uint32_t cpus_online = 1;
+tss_t* cpu_tss[MAX_CPUS] = {&tss};
+static tss_t ap_tss[MAX_CPUS - 1];
+static volatile uint32_t kernel_owner = 1;      // this_cpu() + 1 of the CPU holding the kernel lock, 0 if free.
+                                                // The boot CPU holds it until it first enters user space.
+static volatile uint8_t tlb_flush_wanted[MAX_CPUS];
+uint32_t ap_cr3;                  // read by ap_boot.S
+uint32_t ap_stack;                // read by ap_boot.S
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+extern uint8_t gdt[];
+extern uint32_t gdt_size;
+extern uint8_t ap_trampoline[], ap_trampoline_end[], ap_trampoline_gdtr[];
+extern void apic_spurious();
+extern void tlb_ipi();
+
+// FUNCTION DECLARATIONS
+void smp_init(void);
+void ap_main(void);
+void kernel_lock(void);
+void kernel_unlock(void);
+void smp_kick_idle(void);
+void smp_flush_tlb(uint32_t mask);
+void tlb_flush_ipi(void);
+static void resched_handler(hw_context_t* frame);
+static void tlb_flush_poll(uint32_t cpu);
+static int32_t mp_parse(void);
+static mp_float_t* mp_search(uint32_t start, uint32_t len);
+static uint8_t checksum(void* p, uint32_t len);
+static int32_t start_ap(cpu_t* cpu, uint8_t* stack_top);
+static void delay_us(uint32_t us);
+
+// GLOBAL FUNCTIONS
+/*
+smp_init
+    DESCRIPTION: turns on the local APIC, then finds and starts the other CPUs
+                 and routes IRQs through the IO-APIC. Without an MP table only
+                 the local APIC is turned on.
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: needs paging (for the APIC registers) and the TSC clock (for delays),
+           interrupts must be off
+*/
+void smp_init(void) {
+    idt_desc_t spurious, tlb;
+    cpu_t boot;
+    seg_desc_t tss_desc;
+    uint32_t i;
+    uint8_t* gdtr;
+
+    if (lapic_detect()) {
+        return;
+    }
+
+    // stray APIC interrupts land here instead of an empty gate
+    spurious = idt[IRQ_VECTOR_BASE];
+    SET_IDT_ENTRY(spurious, apic_spurious);
+    idt[APIC_SPURIOUS_VECTOR] = spurious;
+    tlb = idt[IRQ_VECTOR_BASE];
+    SET_IDT_ENTRY(tlb, tlb_ipi);
+    idt[TLB_VECTOR] = tlb;
+    register_interrupt_handler(RESCHED_VECTOR, resched_handler);
+
+    // the boot CPU's local APIC is used (for its timer) even without an MP table
+    lapic_init(1);
+    if (mp_parse()) {
+        return;
+    }
+
+    // the boot CPU goes first, so a CPU's place in cpus[] is its this_cpu()
+    for (i = 0; i < num_cpus; i++) {
+        if (cpus[i].apic_id == lapic_id()) {
+            boot = cpus[i];
+            cpus[i] = cpus[0];
+            cpus[0] = boot;
+            cpus[0].bsp = 1;
+            cpus[0].online = 1;
+        }
+    }
+
+    // a TSS for each of the others, set up like the boot CPU's in kernel.c
+    tss_desc = tss_desc_ptr;
+    tss_desc.type = 0x9; // ltr marked the boot CPU's busy
+    for (i = 1; i < num_cpus; i++) {
+        ap_tss[i - 1].ldt_segment_selector = KERNEL_LDT;
+        ap_tss[i - 1].ss0 = KERNEL_DS;
+        SET_TSS_PARAMS(tss_desc, &ap_tss[i - 1], tss_size);
+        ap_tss_desc_ptr[i - 1] = tss_desc;
+        cpu_tss[i] = &ap_tss[i - 1];
+    }
+
+    // real mode code, with the GDT operand it loads
+    memcpy((void*) AP_TRAMPOLINE, ap_trampoline, ap_trampoline_end - ap_trampoline);
+    gdtr = (uint8_t*) AP_TRAMPOLINE + (ap_trampoline_gdtr - ap_trampoline);
+    *(uint16_t*) gdtr = gdt_size;
+    *(uint32_t*) (gdtr + 2) = (uint32_t) gdt;
+    asm volatile("movl %%cr3, %0" : "=r"(ap_cr3));
+
+    for (i = 0; i < num_cpus; i++) {
+        if (!cpus[i].bsp) {
+            start_ap(&cpus[i], ap_stacks[i] + AP_STACK_SIZE);
+        }
+    }
+
+    if (ioapic_base) {
+        ioapic_init(lapic_id());
+        i8259_to_ioapic();
+    }
+}
+
+/*
+ap_main
+    DESCRIPTION: first C code on a newly started CPU, called from ap_boot.S.
+                 Checks in, waits for the boot CPU to finish booting and leave
+                 the kernel, then becomes the CPU's idle thread and starts
+                 taking tasks.
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none, unless the CPU can't schedule (no local APIC timer to
+             preempt its tasks, or no PCB left for its idle thread). It
+             parks in hlt afterwards.
+*/
+void ap_main(void) {
+    uint32_t i;
+    uint32_t id = lapic_id();
+
+    for (i = 1; i < num_cpus && cpus[i].apic_id != id; i++);
+    if (i == num_cpus) {
+        return;
+    }
+    ltr(AP_TSS + 8 * (i - 1)); // from here on this_cpu() is i
+
+    lapic_init(0);
+    cpus[i].online = 1;
+    // the BSP polls this while it starts the next AP
+    asm volatile("lock; incl %0" : "+m" (cpus_online) : : "memory");
+
+    kernel_lock();
+    if (pit_cpu_init() == 0) {
+        task_cpu_init();
+        lapic_timer_stop();
+    }
+    kernel_unlock();
+}
+
+/*
+kernel_lock
+    DESCRIPTION: takes the kernel lock for this CPU, spinning while another
+                 CPU has it. Called on every way into the kernel, so it does
+                 nothing if this CPU has it already.
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: the task may be switched to another CPU while spinning with
+           interrupts on, so this_cpu() is read again every time around
+*/
+void kernel_lock(void) {
+    uint32_t cpu;
+    uint32_t owner;
+
+    while (1) {
+        cpu = this_cpu();
+        if (kernel_owner == cpu + 1) {
+            return;
+        }
+        owner = 0;
+        asm volatile("lock; cmpxchgl %2, %1"
+                     : "+a"(owner), "+m"(kernel_owner)
+                     : "r"(cpu + 1)
+                     : "memory", "cc");
+        if (owner == 0) {
+            // the CPU that had it pointed the video context at its own task
+            if (cpu_task[cpu]) {
+                task_video_context(cpu_task[cpu]);
+            }
+            return;
+        }
+        // the owner may be waiting on us to flush, and our interrupts may be off
+        tlb_flush_poll(cpu);
+        asm volatile("pause");
+    }
+}
+
+/*
+kernel_unlock
+    DESCRIPTION: lets another CPU into the kernel. Called on the way out to
+                 user space and by the idle thread before it halts.
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+void kernel_unlock(void) {
+    asm volatile("" : : : "memory"); // x86 doesn't move stores ahead of older accesses
+    kernel_owner = 0;
+}
+
+/*
+smp_kick_idle
+    DESCRIPTION: sends a reschedule IPI to the idle CPUs if there is a task
+                 none of the CPUs is running
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: caller holds the kernel lock
+*/
+void smp_kick_idle(void) {
+    uint32_t i;
+
+    if (cpus_online == 1 || !tasks_waiting()) {
+        return;
+    }
+    for (i = 0; i < num_cpus; i++) {
+        if (i != this_cpu() && cpus[i].online && cpu_idle[i] > 0 && cpu_task[i] == cpu_idle[i]) {
+            lapic_send_ipi(cpus[i].apic_id, ICR_FIXED | RESCHED_VECTOR);
+        }
+    }
+}
+
+/*
+smp_flush_tlb
+    DESCRIPTION: makes other CPUs reload CR3 and waits until they have. A CPU
+                 whose page directory has no users left also drops it for the
+                 kernel's (see paging_tlb_flush).
+    INPUTS: mask - bit n set to flush cpus[n], never the calling CPU
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: caller holds the kernel lock
+*/
+void smp_flush_tlb(uint32_t mask) {
+    uint32_t i;
+
+    for (i = 0; i < num_cpus; i++) {
+        if (mask & (1 << i)) {
+            tlb_flush_wanted[i] = 1;
+            lapic_send_ipi(cpus[i].apic_id, ICR_FIXED | TLB_VECTOR);
+        }
+    }
+    for (i = 0; i < num_cpus; i++) {
+        while (tlb_flush_wanted[i]) {
+            asm volatile("pause");
+        }
+    }
+}
+
+/*
+tlb_flush_ipi
+    DESCRIPTION: TLB flush IPI handler, called from ap_boot.S
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+*/
+void tlb_flush_ipi(void) {
+    tlb_flush_poll(this_cpu());
+    lapic_eoi();
+}
+
+// LOCAL FUNCTIONS
+/*
+resched_handler
+    DESCRIPTION: reschedule IPI handler. The boot CPU re-arms the tick for
+                 timers another CPU added, and an idle CPU looks for a task.
+    INPUTS: frame - unused
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void resched_handler(hw_context_t* frame) {
+    if (this_cpu() == 0) {
+        pit_update();
+    }
+    if (CPID == idle_PID) {
+        need_resched = 1;
+    }
+}
+
+/*
+tlb_flush_poll
+    DESCRIPTION: does the TLB flush smp_flush_tlb asked a CPU for, if it did
+    INPUTS: cpu - the running CPU
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void tlb_flush_poll(uint32_t cpu) {
+    if (tlb_flush_wanted[cpu]) {
+        paging_tlb_flush();
+        tlb_flush_wanted[cpu] = 0;
+    }
+}
+
+/*
+mp_parse
+    DESCRIPTION: reads the CPUs, the IO-APIC and the ISA interrupt routing out
+                 of the MP configuration table
+    INPUTS: none
+    OUTPUTS: fills in cpus, num_cpus, ioapic_base, ioapic_isa_*
+    RETURNS: 0 for success, -1 if there is no usable table
+*/
+static int32_t mp_parse(void) {
+    mp_float_t* mpf;
+    mp_config_t* conf;
+    uint8_t* entry;
+    uint8_t isa_bus[MAX_BUSES];
+    uint32_t i, n = 0;
+
+    // the first KB of the EBDA would be searched too, but page 0 (with its
+    // pointer at 0x40E) is left unmapped to catch NULL
+    if (!(mpf = mp_search(0x9FC00, 0x400)) && !(mpf = mp_search(0xF0000, 0x10000))) {
+        return -1;
+    }
+    if (mpf->config == 0 || mpf->config >= FOUR_MB - sizeof(mp_config_t)) {
+        return -1; // default configurations aren't supported
+    }
+    conf = (mp_config_t*) mpf->config;
+    if (conf->signature != MP_CONFIG_SIG || mpf->config + conf->length > FOUR_MB || checksum(conf, conf->length)) {
+        return -1;
+    }
+    if (conf->lapic != lapic_base) {
+        return -1;
+    }
+
+    memset(isa_bus, 0, sizeof(isa_bus));
+    entry = (uint8_t*) conf + sizeof(mp_config_t);
+    for (i = 0; i < conf->entries; i++) {
+        switch (*entry) {
+            case MP_PROCESSOR: {
+                mp_processor_t* p = (mp_processor_t*) entry;
+                if ((p->flags & MP_CPU_ENABLED) && n < MAX_CPUS) {
+                    cpus[n].apic_id = p->apic_id;
+                    cpus[n].bsp = 0;
+                    cpus[n].online = 0;
+                    n++;
+                }
+                entry += sizeof(mp_processor_t);
+                break;
+            }
+            case MP_BUS: {
+                mp_bus_t* b = (mp_bus_t*) entry;
+                if (b->id < MAX_BUSES && !strncmp(b->name, "ISA", 3)) {
+                    isa_bus[b->id] = 1;
+                }
+                entry += sizeof(mp_bus_t);
+                break;
+            }
+            case MP_IOAPIC: {
+                mp_ioapic_t* io = (mp_ioapic_t*) entry;
+                // the first usable one, it is the one the ISA IRQs are wired to on a PC
+                if ((io->flags & MP_IOAPIC_USABLE) && !ioapic_base && (io->addr & ~0x3FFFFF) == APIC_REGION) {
+                    ioapic_base = io->addr;
+                }
+                entry += sizeof(mp_ioapic_t);
+                break;
+            }
+            case MP_IOINT: {
+                mp_ioint_t* in = (mp_ioint_t*) entry;
+                if (in->int_type == MP_INT_VECTORED && in->src_bus < MAX_BUSES && isa_bus[in->src_bus] &&
+                    in->src_irq < NUM_ISA_IRQS) {
+                    ioapic_isa_pin[in->src_irq] = in->dst_pin;
+                    ioapic_isa_flags[in->src_irq] = in->flags;
+                }
+                entry += sizeof(mp_ioint_t);
+                break;
+            }
+            case MP_LOCALINT:
+                entry += sizeof(mp_ioint_t);
+                break;
+            default:
+                return -1; // unknown entry, can't tell how long it is
+        }
+    }
+
+    if (n == 0) {
+        return -1;
+    }
+    num_cpus = n;
+    return 0;
+}
+
+/*
+mp_search
+    DESCRIPTION: looks for the MP floating pointer on 16 byte boundaries
+    INPUTS: start - physical address, len - bytes to search
+    OUTPUTS: none
+    RETURNS: the structure, NULL if not found
+*/
+static mp_float_t* mp_search(uint32_t start, uint32_t len) {
+    uint32_t addr;
+
+    for (addr = start; addr + sizeof(mp_float_t) <= start + len; addr += 16) {
+        if (((mp_float_t*) addr)->signature == MP_FLOAT_SIG && !checksum((void*) addr, sizeof(mp_float_t))) {
+            return (mp_float_t*) addr;
+        }
+    }
+    return NULL;
+}
+
+static uint8_t checksum(void* p, uint32_t len) {
+    uint8_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        sum += ((uint8_t*) p)[i];
+    }
+    return sum;
+}
+
+/*
+start_ap
+    DESCRIPTION: wakes up one CPU with INIT-SIPI-SIPI and waits for it to check in
+    INPUTS: cpu - the CPU, stack_top - its kernel stack
+    OUTPUTS: none
+    RETURNS: 0 for success, -1 if it never showed up
+*/
+static int32_t start_ap(cpu_t* cpu, uint8_t* stack_top) {
+    uint32_t before = cpus_online;
+    uint32_t waited;
+
+    ap_stack = (uint32_t) stack_top;
+
+    if (lapic_send_ipi(cpu->apic_id, ICR_INIT)) {
+        return -1;
+    }
+    delay_us(INIT_DELAY_US);
+    lapic_send_ipi(cpu->apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+    delay_us(SIPI_DELAY_US);
+    if (cpus_online == before) {
+        lapic_send_ipi(cpu->apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+    }
+
+    for (waited = 0; cpus_online == before && waited < AP_WAIT_US; waited += 100) {
+        delay_us(100);
+    }
+    return (cpus_online == before) ? -1 : 0;
+}
+
+static void delay_us(uint32_t us) {
+    uint64_t end = clock_ns() + (uint64_t) us * 1000;
+
+    while (clock_ns() < end);
+}
@@ -0,0 +1,54 @@
+// smp.h
+
+#ifndef SMP_H
+#define SMP_H
+
+#include "types.h"
+#include "x86_desc.h"
+
+#define MAX_CPUS       8
+#define AP_TRAMPOLINE  0x7000 // real mode start address of the other CPUs, must be page aligned and below 1 MB
+#define AP_STACK_SIZE  0x1000
+#define RESCHED_VECTOR 0x31   // IPI: look for work (the boot CPU also re-arms the tick)
+#define TLB_VECTOR     0x32   // IPI: reload CR3, see smp_flush_tlb
+
+#ifndef ASM
+
+typedef struct {
+    uint32_t apic_id;
+    uint8_t bsp;    // the CPU that booted the kernel
+    uint8_t online; // 1 once it is running kernel code
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern uint32_t num_cpus;
+extern volatile uint32_t cpus_online;
+extern tss_t* cpu_tss[MAX_CPUS];
+
+// GLOBAL FUNCTIONS
+extern void smp_init(void);
+extern void ap_main(void);
+extern void kernel_lock(void);
+extern void kernel_unlock(void);
+extern void smp_kick_idle(void);
+extern void smp_flush_tlb(uint32_t mask);
+extern void tlb_flush_ipi(void);
+
+/*
+this_cpu
+    DESCRIPTION: index in cpus[] of the running CPU, told apart by the TSS it
+                 loaded (the boot CPU has KERNEL_TSS, the others AP_TSS on up)
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: the index, 0 on the boot CPU
+*/
+static inline uint32_t this_cpu(void) {
+    uint32_t sel;
+
+    asm volatile("str %0" : "=r"(sel));
+    return ((sel & 0xFFFF) < AP_TSS) ? 0 : ((sel & 0xFFFF) - AP_TSS) / 8 + 1;
+}
+
+#endif /* ASM */
+
+#endif
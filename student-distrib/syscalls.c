@@ -5,6 +5,14 @@
 #include "x86_desc.h"
 #include "paging.h"
 #include "syscalls_asm.h"
+#include "kthread.h"
+#include "pit.h"
+#include "timer.h"
+#include "pipe.h"
+#include "shm.h"
+#include "futex.h"
+#include "ipc.h"
+#include "idt.h"
 
 // CONSTANTS
 #define PROCESS_KERNEL_STACK_ADDR 0x007ffffc // Last location in kernel page that is accessable
@@ -14,14 +22,25 @@
 #define VIRT_ADDR_BYTE_2          25         /* Bytes 24-27 of the EXE hold virtual address of first */
 #define VIRT_ADDR_BYTE_3          26         /* instruction to be executed.                          */
 #define VIRT_ADDR_BYTE_4          27
+#define MSR_SYSENTER_CS           0x174
+#define MSR_SYSENTER_ESP          0x175
+#define MSR_SYSENTER_EIP          0x176
+#define CPUID_SEP                 0x00000800 // cpuid leaf 1 edx, sysenter/sysexit present
+#define USER_STACK                0x093ffffc // initial user esp of a program, USER_STACK_TOP - 4
 
 uint8_t MAGIC_EXE_NUMS[4] = {0x7f, 0x45, 0x4c, 0x46};
 
 // GLOBAL VARIABLES
-uint32_t CPID = 0;
-pcb_t processes[MAX_PROCESSES + 1];
+uint32_t cpu_task[MAX_CPUS]; // task running on each CPU, CPID is this CPU's
+pcb_t processes[NUM_TASKS];
 uint32_t active_processes[NUM_TERMINALS]; // active process for each terminal
 uint8_t needs_to_be_halted[NUM_TERMINALS]; // flag for letting the task_switch know that we need to halt an active processes
+uint8_t needs_base_shell[NUM_TERMINALS]; // flag for letting the task_switch know that a terminal needs its base shell
+int32_t cpu_idle[MAX_CPUS]; // kernel thread each CPU runs when nothing else can, 0 until it has one
+volatile uint8_t need_resched = 0; // set by interrupt handlers that want a task switch
+static uint32_t last_user[MAX_CPUS]; // last user process each CPU ran, kernel threads hand the CPU back to it
+static uint32_t handoff_PID = 0; // task_handoff asked for this task to run next
+static uint8_t has_sysenter = 0;
 
 // File Ops Tables
 int32_t no_read (file_t * file, uint8_t * buf, int32_t nbytes) {
@@ -41,6 +60,16 @@ static fileops_t rtc_jumptable = {rtc_open, rtc_read, rtc_write, rtc_close};
 // FUNCTION DECLARATIONS
 void syscalls_init();
 void task_switch();
+void task_sleep();
+void task_wake(uint32_t PID);
+void task_handoff(uint32_t PID);
+int32_t runnable_tasks();
+int32_t tasks_waiting();
+void task_cpu_init(void);
+void task_video_context(uint32_t PID);
+static int32_t task_runnable(uint32_t PID);
+static int32_t task_available(uint32_t PID);
+static void set_kernel_stack(uint32_t esp0);
 int execute_base_shell(unsigned char terminal);
 int32_t halt (uint8_t status);
 int32_t execute (int8_t* command);
@@ -50,12 +79,24 @@ int32_t open (const int8_t* filename);
 int32_t close (int32_t fd);
 int32_t getargs (int8_t* buf, int32_t nbytes);
 int32_t vidmap (uint8_t** screenstart);
-int32_t set_handler (int32_t signum, void* handler_address);
-int32_t sigreturn (void);
+void vidmap_refresh();
+static uint32_t vidmap_page(uint32_t PID);
+int32_t spawn (int8_t* command, int32_t fd_in, int32_t fd_out);
+int32_t wait (int32_t pid);
+int32_t interrupt_pipeline(uint32_t PID);
+static int32_t parse_command(int8_t* command, int8_t* exename, int8_t* args, uint32_t* args_size);
+static uint32_t load_program(uint32_t PID, const int8_t* exename);
+static void release_fds(uint32_t PID);
+static void release_children(uint32_t PID);
+static void spawned_exit(int32_t status);
+int32_t clone (uint32_t entry, uint32_t stack);
+static void task_cleanup(uint32_t PID);
+static void thread_exit(void);
+static void kill_threads(uint32_t PID);
 
 /*
  * syscalls_init
- *   DESCRIPTION:  Initializes PCB structs
+ *   DESCRIPTION:  Initializes PCB structs and the sysenter MSRs
  *   INPUTS:       none
  *   OUTPUTS:      none
  *   RETURN VALUE: none
@@ -63,6 +104,16 @@ int32_t sigreturn (void);
  */
 void syscalls_init() {
     int32_t i;
+    uint32_t regs[4];
+
+    /* sysenter lands on sysenter_wrapper in kernel CS, the stack follows CPID */
+    cpuid(1, regs);
+    if (regs[3] & CPUID_SEP) {
+        has_sysenter = 1;
+        wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+        wrmsr(MSR_SYSENTER_EIP, (uint32_t) sysenter_wrapper);
+        set_kernel_stack(tss.esp0);
+    }
 
     /* Initialize the PCB with the pertinent information */
     for (i = 0; i < MAX_FD; i++) {
@@ -74,8 +125,10 @@ void syscalls_init() {
     }
     processes[CPID].fd_array[0].jumptable = &stdin_jumptable;
     processes[CPID].fd_array[1].jumptable = &stdout_jumptable;
+    processes[CPID].files = processes[CPID].fd_array;
     processes[CPID].PID = CPID;
     processes[CPID].PPID = 0;
+    processes[CPID].tgid = CPID;
     processes[CPID].running = 1;
     processes[CPID].args[0] = '\0';
     processes[CPID].args_size = 0;
@@ -85,12 +138,18 @@ void syscalls_init() {
     for (i = 0; i < NUM_TERMINALS; i++) {
         active_processes[i] = 0;
         needs_to_be_halted[i] = 0;
+        needs_base_shell[i] = 0;
     }
+    idle_PID = kthread_create(kthread_idle);
 }
 
 /*
  * task_switch
- *   DESCRIPTION:  switches the running task to a different active process
+ *   DESCRIPTION:  switches the task running on this CPU to a different active
+ *                 process. Kernel threads with work to do always go first, after
+ *                 that every active process that is not asleep or running on
+ *                 another CPU gets a turn. The CPU's idle thread runs when nobody
+ *                 else can.
  *   INPUTS:       none
  *   OUTPUTS:      none
  *   RETURN VALUE: none
@@ -98,9 +157,20 @@ void syscalls_init() {
  */
 void task_switch() {
     cli();
+    interrupt_stats_stop();
+
+    int i;
+    int old_esp, old_ebp;
+
+    // a thread of this process died by exception, take the rest down with it
+    if (!processes[CPID].kthread && processes[CPID].killed) {
+        exception_halt();
+        return;
+    }
 
     // check if we need to halt this process
-    if (needs_to_be_halted[processes[CPID].terminal]) {
+    if (!processes[CPID].kthread && CPID == active_processes[processes[CPID].terminal]
+            && needs_to_be_halted[processes[CPID].terminal]) {
         needs_to_be_halted[processes[CPID].terminal] = 0;
         clear();
         set_pos(0, 0);
@@ -109,81 +179,371 @@ void task_switch() {
         return;
     }
 
-    // find next active process
-    int old_CPID = CPID;
-    int i = processes[old_CPID].terminal;
-    do {
-        i++;
-    } while (active_processes[i % NUM_TERMINALS] == 0);
-    CPID = active_processes[i % NUM_TERMINALS];
-
-    // return if there are no other active processes
-    if (CPID == old_CPID) {
-        return;
+    // check if a terminal is waiting for its base shell (requested by the keyboard bottom half)
+    for (i = 0; i < NUM_TERMINALS; i++) {
+        if (needs_base_shell[i]) {
+            needs_base_shell[i] = 0;
+            if (!processes[CPID].kthread) {
+                last_user[this_cpu()] = CPID;
+            }
+            __asm__("movl %%esp, %0; movl %%ebp, %1"
+                     :"=g"(old_esp), "=g"(old_ebp) /* outputs */
+                    );
+            processes[CPID].esp_switch = old_esp;
+            processes[CPID].ebp_switch = old_ebp;
+            if (i == cur_terminal) {
+                set_video_context(ACTIVE_CONTEXT);
+            } else {
+                set_video_context(i);
+            }
+            execute_base_shell(i);
+            return;
+        }
     }
 
-    // adjust video memory
-    if (processes[CPID].terminal == cur_terminal) {
-        set_video_context(ACTIVE_CONTEXT);
-    } else {
-        set_video_context(processes[CPID].terminal);
+    int old_CPID = CPID;
+    if (!processes[old_CPID].kthread) {
+        last_user[this_cpu()] = old_CPID;
     }
 
-    // adjust user mapping into video memory
-    // for old process
-    if (processes[old_CPID].using_video_mem) {
-        if (processes[old_CPID].terminal == cur_terminal) {
-            new_page_directory_entry(old_CPID, USER_PAGE_BOTTOM, VIDEO, 0, 3);
-        } else {
-            if (processes[old_CPID].terminal == 0) {
-                new_page_directory_entry(old_CPID, USER_PAGE_BOTTOM, VIDEO_0, 0, 3);
-            } else if (processes[old_CPID].terminal == 1) {
-                new_page_directory_entry(old_CPID, USER_PAGE_BOTTOM, VIDEO_1, 0, 3);
-            } else if (processes[old_CPID].terminal == 2) {
-                new_page_directory_entry(old_CPID, USER_PAGE_BOTTOM, VIDEO_2, 0, 3);
-            }
+    // kernel threads with pending work run first
+    int next = 0;
+    for (i = MAX_PROCESSES + 1; i < NUM_TASKS; i++) {
+        if (i != idle_PID && task_available(i)) {
+            next = i;
+            break;
         }
     }
-    // and new process
-    if (processes[CPID].using_video_mem) {
-        if (processes[CPID].terminal == cur_terminal) {
-            new_page_directory_entry(CPID, USER_PAGE_BOTTOM, VIDEO, 0, 3);
-        } else {
-            if (processes[CPID].terminal == 0) {
-                new_page_directory_entry(CPID, USER_PAGE_BOTTOM, VIDEO_0, 0, 3);
-            } else if (processes[CPID].terminal == 1) {
-                new_page_directory_entry(CPID, USER_PAGE_BOTTOM, VIDEO_1, 0, 3);
-            } else if (processes[CPID].terminal == 2) {
-                new_page_directory_entry(CPID, USER_PAGE_BOTTOM, VIDEO_2, 0, 3);
+
+    // then whoever task_handoff picked
+    if (next == 0 && handoff_PID != 0 && task_available(handoff_PID)) {
+        next = handoff_PID;
+    }
+    handoff_PID = 0;
+
+    // otherwise find next runnable process, kernel threads give the CPU back to the
+    // process they interrupted instead of skipping it
+    if (next == 0) {
+        i = last_user[this_cpu()];
+        if (processes[old_CPID].kthread && task_available(i)) {
+            next = i;
+        }
+        int tries;
+        for (tries = 0; next == 0 && tries < MAX_PROCESSES; tries++) {
+            i = (i % MAX_PROCESSES) + 1;
+            if (task_available(i)) {
+                next = i;
             }
         }
     }
 
+    // everybody is asleep or on another CPU
+    if (next == 0) {
+        next = (idle_PID > 0) ? idle_PID : old_CPID;
+    }
+    CPID = next;
+
+    // return if there are no other active processes
+    if (CPID == old_CPID) {
+        return;
+    }
+
+    // an idle CPU can take the task we are leaving
+    if (task_runnable(old_CPID)) {
+        smp_kick_idle();
+    }
+
+    // adjust video memory (kernel threads pick their own)
+    task_video_context(CPID);
+
     // save esp/ebp
-    int old_esp, old_ebp;
     __asm__("movl %%esp, %0; movl %%ebp, %1"
              :"=g"(old_esp), "=g"(old_ebp) /* outputs */
             );
     processes[old_CPID].esp_switch = old_esp;
     processes[old_CPID].ebp_switch = old_ebp;
 
-    /* Write to TSS SS0 and ESP0 fields with new kernel stack info */
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1));
+    // kernel threads never leave ring 0 and keep whatever page directory is loaded
+    if (!processes[CPID].kthread) {
+        /* Write to TSS SS0 and ESP0 fields with new kernel stack info */
+        cpu_tss[this_cpu()]->ss0 = KERNEL_DS;
+        set_kernel_stack(PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1)));
 
-    // switch page directories
-    swap_pages(CPID);
+        // switch page directories
+        swap_pages(CPID);
+
+        // first run of a spawned process or a thread, enter user space from an empty stack
+        if (processes[CPID].esp_switch == 0) {
+            asm volatile("movl %0, %%esp;\
+                          xorl %%ebp, %%ebp;\
+                          pushl %2;\
+                          pushl %1;\
+                          call kernel_to_user_stack"
+                          :
+                          : "r"(PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1))), "r"(processes[CPID].entry),
+                            "r"(processes[CPID].user_stack)
+                      );
+        }
+    } else if (processes[CPID].esp_switch == 0) {
+        // first run of a kernel thread, start it on an empty stack
+        asm volatile("movl %0, %%esp;\
+                      xorl %%ebp, %%ebp;\
+                      sti;\
+                      call kthread_main"
+                      :
+                      : "r"(PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1)))
+                  );
+    }
 
     // load new esp/ebp and continue executing from new context
     asm volatile("movl %0, %%ebp;\
                   movl %1, %%esp;\
                   sti"
                   :
-                  : "g"(processes[CPID].ebp_switch), "g"(processes[CPID].esp_switch)
+                  : "r"(processes[CPID].ebp_switch), "r"(processes[CPID].esp_switch)
               );
+
+    // now running in the new context, a process that was asked to halt while it
+    // was off the processor does so right away instead of waiting for its next tick
+    if (!processes[CPID].kthread && (processes[CPID].killed || (CPID == active_processes[processes[CPID].terminal]
+            && needs_to_be_halted[processes[CPID].terminal]))) {
+        task_switch();
+    }
     return; // should switch to new context
 }
 
+/*
+ * task_sleep
+ *   DESCRIPTION:  blocks the current task until task_wake is called on it.
+ *                 Callers should check their wakeup condition with interrupts
+ *                 off right before calling this so no wakeup is lost, and check
+ *                 it again afterwards.
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: context switch
+ */
+void task_sleep() {
+    cli();
+    processes[CPID].sleeping = 1;
+    task_switch();
+}
+
+/*
+ * task_wake
+ *   DESCRIPTION:  makes a sleeping task runnable again. Kernel threads preempt
+ *                 user processes and anything preempts the idle thread.
+ *   INPUTS:       PID of the task
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may context switch, may restart the scheduler tick
+ */
+void task_wake(uint32_t PID) {
+    uint32_t flags;
+
+    if (PID >= NUM_TASKS) {
+        return;
+    }
+
+    cli_and_save(flags);
+    if (!processes[PID].sleeping) {
+        restore_flags(flags);
+        return;
+    }
+    processes[PID].sleeping = 0;
+
+    // a second runnable task means time slicing again
+    pit_update();
+
+    // still booting (no shell yet), the next task_switch will pick it up
+    if (CPID != 0 && (CPID == idle_PID || (processes[PID].kthread && !processes[CPID].kthread))) {
+        if (in_interrupt()) {
+            need_resched = 1; // interrupt_dispatch switches once the handlers are done
+        } else {
+            task_switch();
+        }
+    }
+    restore_flags(flags);
+}
+
+/*
+ * task_handoff
+ *   DESCRIPTION:  wakes a task and switches straight to it, skipping the round
+ *                 robin order (kernel threads with work still go first). Used
+ *                 when the caller is about to wait for that task anyway.
+ *   INPUTS:       PID of the task
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: context switch
+ */
+void task_handoff(uint32_t PID) {
+    uint32_t flags;
+
+    if (PID >= NUM_TASKS) {
+        return;
+    }
+
+    cli_and_save(flags);
+    processes[PID].sleeping = 0;
+    handoff_PID = PID;
+    pit_update();
+    task_switch();
+    restore_flags(flags);
+}
+
+/*
+ * runnable_tasks
+ *   DESCRIPTION:  counts the tasks that want the processor (not counting idle)
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: number of runnable tasks
+ *   SIDE EFFECTS: none
+ */
+int32_t runnable_tasks() {
+    int32_t i;
+    int32_t count = 0;
+
+    for (i = 1; i < NUM_TASKS; i++) {
+        if (i != idle_PID && task_runnable(i)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * task_runnable
+ *   DESCRIPTION:  checks if a task can be scheduled
+ *   INPUTS:       PID of the task
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 1 if runnable, 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t task_runnable(uint32_t PID) {
+    if (PID == 0 || PID >= NUM_TASKS || !processes[PID].running || processes[PID].sleeping) {
+        return 0;
+    }
+    return processes[PID].kthread || processes[PID].active;
+}
+
+/*
+ * task_available
+ *   DESCRIPTION:  checks if this CPU can switch to a task: it has to be runnable
+ *                 and not already running on another CPU
+ *   INPUTS:       PID of the task
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 1 if available, 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t task_available(uint32_t PID) {
+    uint32_t i;
+
+    if (!task_runnable(PID)) {
+        return 0;
+    }
+    for (i = 0; i < num_cpus; i++) {
+        if (i != this_cpu() && cpu_task[i] == PID) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * tasks_waiting
+ *   DESCRIPTION:  counts the runnable tasks no CPU is running
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: number of tasks waiting for a CPU
+ *   SIDE EFFECTS: none
+ */
+int32_t tasks_waiting() {
+    int32_t i;
+    uint32_t j;
+    int32_t count = 0;
+
+    for (i = 1; i < NUM_TASKS; i++) {
+        if (task_runnable(i)) {
+            count++;
+            for (j = 0; j < num_cpus; j++) {
+                if (cpu_task[j] == i) {
+                    count--;
+                    break;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+/*
+ * task_cpu_init
+ *   DESCRIPTION:  gives a newly started CPU an idle thread and its sysenter
+ *                 MSRs, then turns the calling context into that idle thread,
+ *                 which task_switch hands work to from then on
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none, only returns if there is no PCB left for the idle thread
+ *   SIDE EFFECTS: leaves the caller's stack behind
+ *   NOTES:        caller holds the kernel lock
+ */
+void task_cpu_init(void) {
+    int32_t idle = kthread_create(kthread_idle);
+
+    if (idle < 0) {
+        return;
+    }
+    if (has_sysenter) {
+        wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+        wrmsr(MSR_SYSENTER_EIP, (uint32_t) sysenter_wrapper);
+    }
+    idle_PID = idle;
+    CPID = idle;
+
+    asm volatile("movl %0, %%esp;\
+                  xorl %%ebp, %%ebp;\
+                  call kthread_main"
+                  :
+                  : "r"(PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(idle-1)))
+              );
+}
+
+/*
+ * task_video_context
+ *   DESCRIPTION:  points the kernel's video memory at the terminal of a user
+ *                 task, the screen itself if that terminal is showing
+ *   INPUTS:       PID of the task, kernel threads are left alone
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the video context
+ */
+void task_video_context(uint32_t PID) {
+    if (processes[PID].kthread) {
+        return;
+    }
+    if (processes[PID].terminal == cur_terminal) {
+        set_video_context(ACTIVE_CONTEXT);
+    } else {
+        set_video_context(processes[PID].terminal);
+    }
+}
+
+/*
+ * set_kernel_stack
+ *   DESCRIPTION:  points both ways into the kernel (int 0x80/interrupts through
+ *                 the TSS and sysenter through its MSR) at a kernel stack
+ *   INPUTS:       esp0 - top of the kernel stack
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes this CPU's TSS and MSR
+ */
+static void set_kernel_stack(uint32_t esp0) {
+    cpu_tss[this_cpu()]->esp0 = esp0;
+    if (has_sysenter) {
+        wrmsr(MSR_SYSENTER_ESP, esp0);
+    }
+}
+
 /*
  * execute_base_shell
  *   DESCRIPTION:  starts the base shell in a given terminal
@@ -195,7 +555,7 @@ void task_switch() {
 int execute_base_shell(unsigned char terminal) {
     cli();
 
-    int32_t i;
+    int32_t i, size;
     uint8_t new_eip[4];
     uint32_t user_entry;
 
@@ -242,9 +602,23 @@ int execute_base_shell(unsigned char terminal) {
     processes[CPID].terminal = terminal;
     active_processes[processes[CPID].terminal] = CPID;
     processes[CPID].using_video_mem = 0;
+    processes[CPID].using_ring = 0;
+    processes[CPID].spawned = 0;
+    processes[CPID].zombie = 0;
+    processes[CPID].tgid = CPID;
+    processes[CPID].files = processes[CPID].fd_array;
+    processes[CPID].killed = 0;
+    signal_task_init(CPID);
+    processes[CPID].sleeping = 0;
+    timer_setup(&processes[CPID].sleep_timer, timer_wakeup, CPID);
+
+    // another shell to time slice with
+    pit_update();
 
     /* Set up paging for current process */
-    new_page_directory(CPID);
+    if ((size = fs_size("shell")) == -1 || new_page_directory(CPID, EXE_ENTRY_POINT - PROGRAM_IMAGE + size)) {
+        return -1;
+    }
 
     /* Load the file into memory */
     if (fs_copy("shell", (uint8_t *) EXE_ENTRY_POINT)) {
@@ -263,8 +637,8 @@ int execute_base_shell(unsigned char terminal) {
     }
 
     /* Write to TSS SS0 and ESP0 fields with new kernel stack info */
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1));
+    cpu_tss[this_cpu()]->ss0 = KERNEL_DS;
+    set_kernel_stack(PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1)));
 
     /* Context switch */
     kernel_to_user(user_entry);
@@ -287,10 +661,24 @@ int32_t halt (uint8_t status) {
 
     int32_t i;
 
+    /* A thread only ends itself, the process goes on */
+    if (processes[CPID].tgid != CPID) {
+        thread_exit();
+    }
+    kill_threads(CPID);
+
     /* Close all file descriptors */
     for (i = 0; i < MAX_FD; i++) {
         close(i);
     }
+    task_cleanup(CPID);
+    release_children(CPID);
+
+    /* A spawned process has no execute to return to */
+    if (processes[CPID].spawned) {
+        release_fds(CPID);
+        spawned_exit(status);
+    }
 
     /* update process info */
     processes[CPID].running = 0;
@@ -314,7 +702,7 @@ int32_t halt (uint8_t status) {
         return 0;
     } else {
         swap_pages(CPID);
-        tss.esp0 = PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1));
+        set_kernel_stack(PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1)));
     }
 
     uint32_t ret = (uint32_t) status;
@@ -337,10 +725,26 @@ int32_t exception_halt () {
 
     int32_t i;
 
+    /* A faulting thread takes its whole process down, the main thread does the cleanup */
+    if (processes[CPID].tgid != CPID) {
+        processes[processes[CPID].tgid].killed = 1;
+        task_wake(processes[CPID].tgid);
+        thread_exit();
+    }
+    kill_threads(CPID);
+
     /* Close all file descriptors */
     for (i = 0; i < MAX_FD; i++) {
         close(i);
     }
+    task_cleanup(CPID);
+    release_children(CPID);
+
+    /* A spawned process has no execute to return to */
+    if (processes[CPID].spawned) {
+        release_fds(CPID);
+        spawned_exit(256);
+    }
 
     /* Set the current process running flag to 0 and update CPID field */
     processes[CPID].running = 0;
@@ -364,7 +768,7 @@ int32_t exception_halt () {
         return 0;
     } else {
         swap_pages(CPID);
-        tss.esp0 = PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1));
+        set_kernel_stack(PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1)));
     }
     haltasm(processes[CPID].ebp_execute, processes[CPID].esp_execute, 256);
 
@@ -386,59 +790,17 @@ int32_t exception_halt () {
 int32_t execute (int8_t* command) {
     cli();
 
-    int8_t exename[MAX_FNAME_LEN];
-    int32_t i, j;
+    int8_t exename[MAX_FNAME_LEN + 1];
+    int32_t i;
     int32_t old_CPID;
-    int32_t fd;
-    uint8_t first_bytes[4];
-    uint8_t new_eip[4];
+    uint32_t old_active;
     int8_t args[BUFFER_SIZE];
     uint32_t args_size;
     uint32_t user_entry;
     int32_t old_esp, old_ebp;
 
     /* Parse command passed into execute() */
-    if (command == NULL) {
-        return -1;
-    }
-
-    i = 0;
-    while (command[i] != '\0' && command[i] != ' ') {
-      if (i >= MAX_FNAME_LEN)
-        return -1;
-      exename[i] = command[i];
-      i++;
-    }
-
-    exename[i] = '\0';
-
-    while (command[i] == ' ') {
-        i++;
-    }
-
-    args_size = 0;
-    for (j = i; command[j] != '\0' && j < (BUFFER_SIZE - i);  j++) {
-        if (CPID < MAX_PROCESSES) {
-            args[j - i] = command[j];
-            args_size++;
-        }
-    }
-
-    /* Fetch the file executable */
-    if ((fd = open(exename)) == -1) {
-        return -1;
-    }
-
-    /* Check to make sure the file is executable */
-    if (read(fd, first_bytes, 4) == -1) {
-        return -1;
-    }
-
-    if (close(fd) == -1 && CPID != 0) {
-        return -1;
-    }
-
-    if (strncmp((int8_t *) MAGIC_EXE_NUMS, (int8_t *) first_bytes, 4)) {
+    if (parse_command(command, exename, args, &args_size)) {
         return -1;
     }
 
@@ -482,15 +844,306 @@ int32_t execute (int8_t* command) {
     processes[CPID].active = 1;
     processes[old_CPID].active = 0;
     processes[CPID].terminal = processes[old_CPID].terminal; // inherit from parent
+    old_active = active_processes[processes[CPID].terminal];
     active_processes[processes[CPID].terminal] = CPID;
     processes[CPID].using_video_mem = 0;
+    processes[CPID].using_ring = 0;
+    processes[CPID].spawned = 0;
+    processes[CPID].zombie = 0;
+    processes[CPID].tgid = CPID;
+    processes[CPID].files = processes[CPID].fd_array;
+    processes[CPID].killed = 0;
+    signal_task_init(CPID);
+    processes[CPID].sleeping = 0;
+    timer_setup(&processes[CPID].sleep_timer, timer_wakeup, CPID);
+
+    /* Set up paging for current process and load the file into memory */
+    if (!(user_entry = load_program(CPID, exename))) {
+        // hand everything back to the parent, which keeps running
+        swap_pages(old_CPID);
+        release_page_directory(CPID);
+        signal_task_exit(CPID);
+        processes[CPID].running = 0;
+        processes[CPID].active = 0;
+        processes[old_CPID].active = 1;
+        active_processes[processes[CPID].terminal] = old_active;
+        CPID = old_CPID;
+        return -1;
+    }
 
-    /* Set up paging for current process */
-    new_page_directory(CPID);
+    /* Save current ESP and EBP into PCB */
+    __asm__("movl %%esp, %0; movl %%ebp, %1"
+             :"=g"(old_esp), "=g"(old_ebp) /* outputs */
+            );
+    processes[old_CPID].esp_execute = old_esp;
+    processes[old_CPID].ebp_execute = old_ebp;
+
+    /* Write to TSS SS0 and ESP0 fields with new kernel stack info */
+    cpu_tss[this_cpu()]->ss0 = KERNEL_DS;
+    set_kernel_stack(PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1)));
+
+    /* Context switch */
+    kernel_to_user(user_entry);
+
+    return 0;
+}
+
+/*
+ * spawn
+ *   DESCRIPTION:  Loads a program as a child that runs alongside the caller
+ *                 instead of replacing it until it halts. The child takes the
+ *                 foreground of the terminal. Collect it with wait().
+ *   INPUTS:       command - same as execute
+ *                 fd_in - caller's descriptor to hand the child as its fd 0,
+ *                         -1 for the keyboard
+ *                 fd_out - caller's descriptor to hand the child as its fd 1,
+ *                          -1 for the screen
+ *   OUTPUTS:      none
+ *   RETURN VALUE: PID of the child, -1 if it cannot be started
+ *   SIDE EFFECTS: Overwrites PCB structs and memory
+ */
+int32_t spawn (int8_t* command, int32_t fd_in, int32_t fd_out) {
+    int8_t exename[MAX_FNAME_LEN + 1];
+    int8_t args[BUFFER_SIZE];
+    uint32_t args_size;
+    uint32_t user_entry;
+    uint32_t PID;
+    int32_t i;
+
+    if (fd_in >= MAX_FD || (fd_in >= 0 && !processes[CPID].files[fd_in].flags.in_use) ||
+        fd_out >= MAX_FD || (fd_out >= 0 && !processes[CPID].files[fd_out].flags.in_use)) {
+        return -1;
+    }
+
+    if (parse_command(command, exename, args, &args_size)) {
+        return -1;
+    }
+
+    cli();
+    for (PID = 1; PID <= MAX_PROCESSES && processes[PID].running; PID++);
+    if (PID > MAX_PROCESSES) {
+        sti();
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FD; i++) {
+        processes[PID].fd_array[i].flags.in_use = 0;
+    }
+    processes[PID].fd_array[0].jumptable = &stdin_jumptable;
+    processes[PID].fd_array[0].flags.in_use = 1;
+    processes[PID].fd_array[1].jumptable = &stdout_jumptable;
+    processes[PID].fd_array[1].flags.in_use = 1;
+    if (fd_in >= 0) {
+        processes[PID].fd_array[0] = processes[CPID].files[fd_in];
+        pipe_dup(&processes[PID].fd_array[0]);
+        rtc_dup(&processes[PID].fd_array[0]);
+    }
+    if (fd_out >= 0) {
+        processes[PID].fd_array[1] = processes[CPID].files[fd_out];
+        pipe_dup(&processes[PID].fd_array[1]);
+        rtc_dup(&processes[PID].fd_array[1]);
+    }
+
+    processes[PID].PID = PID;
+    processes[PID].PPID = CPID;
+    processes[PID].running = 1;
+
+    memcpy(processes[PID].args, args, args_size);
+    processes[PID].args[args_size] = '\0';
+    processes[PID].args_size = args_size;
+
+    processes[PID].terminal = processes[CPID].terminal;
+    processes[PID].using_video_mem = 0;
+    processes[PID].using_ring = 0;
+    processes[PID].spawned = 1;
+    processes[PID].zombie = 0;
+    processes[PID].tgid = PID;
+    processes[PID].files = processes[PID].fd_array;
+    processes[PID].killed = 0;
+    signal_task_init(PID);
+    processes[PID].sleeping = 0;
+    timer_setup(&processes[PID].sleep_timer, timer_wakeup, PID);
+
+    /* Build the child's address space, then come back to ours */
+    user_entry = load_program(PID, exename);
+    swap_pages(CPID);
+    if (!user_entry) {
+        release_page_directory(PID);
+        release_fds(PID);
+        signal_task_exit(PID);
+        processes[PID].running = 0;
+        sti();
+        return -1;
+    }
+
+    /* task_switch starts it in user space the first time it is picked */
+    processes[PID].entry = user_entry;
+    processes[PID].user_stack = USER_STACK;
+    processes[PID].esp_switch = 0;
+    processes[PID].active = 1;
+    active_processes[processes[PID].terminal] = PID;
+
+    pit_update();
+    sti();
+    return PID;
+}
+
+/*
+ * wait
+ *   DESCRIPTION:  Blocks until a spawned child halts and frees its PCB
+ *   INPUTS:       pid - child returned by spawn
+ *   OUTPUTS:      none
+ *   RETURN VALUE: the child's halt status (256 if it died by exception),
+ *                 -1 if pid is not a child of the caller
+ *   SIDE EFFECTS: may sleep
+ */
+int32_t wait (int32_t pid) {
+    int32_t status;
+
+    if (pid < 1 || pid > MAX_PROCESSES) {
+        return -1;
+    }
+
+    cli();
+    if (!processes[pid].running || !processes[pid].spawned || processes[pid].PPID != CPID) {
+        sti();
+        return -1;
+    }
+    while (!processes[pid].zombie) {
+        task_sleep();
+        cli();
+    }
+
+    status = processes[pid].exit_status;
+    processes[pid].zombie = 0;
+    processes[pid].spawned = 0;
+    processes[pid].running = 0;
+    sti();
+    return status;
+}
+
+/*
+ * interrupt_pipeline
+ *   DESCRIPTION:  CTRL-C for a spawned foreground process. It is one stage of
+ *                 a pipeline, so every stage its parent spawned on the same
+ *                 terminal gets INTERRUPT, and the ones without a handler for
+ *                 it are halted like an exception would.
+ *   INPUTS:       PID - the spawned foreground process
+ *   OUTPUTS:      none
+ *   RETURN VALUE: number of stages that were halted
+ *   SIDE EFFECTS: wakes the halted stages so they go away even if blocked
+ */
+int32_t interrupt_pipeline(uint32_t PID) {
+    uint32_t flags;
+    uint32_t parent = processes[PID].PPID;
+    uint8_t terminal = processes[PID].terminal;
+    uint32_t i;
+    int32_t halted = 0;
+
+    cli_and_save(flags);
+    for (i = 1; i <= MAX_PROCESSES; i++) {
+        if (!processes[i].running || !processes[i].spawned || processes[i].zombie ||
+                processes[i].tgid != i || processes[i].PPID != parent ||
+                processes[i].terminal != terminal) {
+            continue;
+        }
+        if (signal_send(i, INTERRUPT) == 0) {
+            continue;
+        }
+        processes[i].killed = 1;
+        task_wake(i);
+        halted++;
+    }
+    restore_flags(flags);
+    return halted;
+}
+
+/*
+ * parse_command
+ *   DESCRIPTION:  Splits a command into the executable and its arguments and
+ *                 checks that the executable really is one
+ *   INPUTS:       command - space-separated sequence of words
+ *   OUTPUTS:      exename - first word (MAX_FNAME_LEN + 1 bytes)
+ *                 args - rest of the command (BUFFER_SIZE bytes)
+ *                 args_size - length of args
+ *   RETURN VALUE: 0 if successful, -1 if not
+ *   SIDE EFFECTS: opens and closes the executable in the current process
+ */
+static int32_t parse_command(int8_t* command, int8_t* exename, int8_t* args, uint32_t* args_size) {
+    int32_t i, j;
+    int32_t fd;
+    uint8_t first_bytes[4];
+
+    if (command == NULL) {
+        return -1;
+    }
+
+    i = 0;
+    while (command[i] != '\0' && command[i] != ' ') {
+      if (i >= MAX_FNAME_LEN)
+        return -1;
+      exename[i] = command[i];
+      i++;
+    }
+
+    exename[i] = '\0';
+
+    while (command[i] == ' ') {
+        i++;
+    }
+
+    *args_size = 0;
+    for (j = i; command[j] != '\0' && j < (BUFFER_SIZE - i);  j++) {
+        if (CPID < MAX_PROCESSES) {
+            args[j - i] = command[j];
+            (*args_size)++;
+        }
+    }
+
+    /* Fetch the file executable */
+    if ((fd = open(exename)) == -1) {
+        return -1;
+    }
+
+    /* Check to make sure the file is executable */
+    if (read(fd, first_bytes, 4) == -1) {
+        return -1;
+    }
+
+    if (close(fd) == -1 && CPID != 0) {
+        return -1;
+    }
+
+    if (strncmp((int8_t *) MAGIC_EXE_NUMS, (int8_t *) first_bytes, 4)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * load_program
+ *   DESCRIPTION:  Sets up a fresh page directory for a process and copies an
+ *                 executable into it
+ *   INPUTS:       PID - process to load into
+ *                 exename - executable
+ *   OUTPUTS:      none
+ *   RETURN VALUE: entry point, 0 if the file could not be loaded
+ *   SIDE EFFECTS: leaves the new page directory loaded
+ */
+static uint32_t load_program(uint32_t PID, const int8_t* exename) {
+    uint8_t new_eip[4];
+    uint32_t user_entry;
+    int32_t i, size;
+
+    /* Set up paging for the process, with room for the whole file */
+    if ((size = fs_size(exename)) == -1 || new_page_directory(PID, EXE_ENTRY_POINT - PROGRAM_IMAGE + size)) {
+        return 0;
+    }
 
     /* Load the file into memory */
     if (fs_copy(exename, (uint8_t *) EXE_ENTRY_POINT)) {
-        return -1;
+        return 0;
     }
 
     /* Determine the entry point for the executable */
@@ -503,22 +1156,197 @@ int32_t execute (int8_t* command) {
     for (i = 0; i < 4; i ++) {
         user_entry |= (uint32_t) new_eip[i] << (8*i);
     }
+    return user_entry;
+}
 
-    /* Save current ESP and EBP into PCB */
-    __asm__("movl %%esp, %0; movl %%ebp, %1"
-             :"=g"(old_esp), "=g"(old_ebp) /* outputs */
-            );
-    processes[old_CPID].esp_execute = old_esp;
-    processes[old_CPID].ebp_execute = old_ebp;
+/*
+ * release_fds
+ *   DESCRIPTION:  Closes every file descriptor of a process. A spawned process
+ *                 may have pipes as fd 0/1 so those are closed too.
+ *   INPUTS:       PID of the process
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void release_fds(uint32_t PID) {
+    int32_t i;
 
-    /* Write to TSS SS0 and ESP0 fields with new kernel stack info */
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = PROCESS_KERNEL_STACK_ADDR - (STACK_SIZE*(CPID-1));
+    for (i = 0; i < MAX_FD; i++) {
+        if (processes[PID].fd_array[i].flags.in_use) {
+            processes[PID].fd_array[i].flags.in_use = 0;
+            processes[PID].fd_array[i].jumptable->close(&processes[PID].fd_array[i]);
+        }
+    }
+}
 
-    /* Context switch */
-    kernel_to_user(user_entry);
+/*
+ * release_children
+ *   DESCRIPTION:  Disowns the spawned children of a halting process. Children
+ *                 that already halted are freed, the rest free themselves.
+ *   INPUTS:       PID of the parent
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void release_children(uint32_t PID) {
+    uint32_t i;
+
+    for (i = 1; i <= MAX_PROCESSES; i++) {
+        if (processes[i].running && processes[i].spawned && processes[i].PPID == PID) {
+            processes[i].PPID = 0;
+            if (processes[i].zombie) {
+                processes[i].zombie = 0;
+                processes[i].spawned = 0;
+                processes[i].running = 0;
+            }
+        }
+    }
+}
 
-    return 0;
+/*
+ * spawned_exit
+ *   DESCRIPTION:  Second half of halt for a spawned process. Nobody is waiting
+ *                 in execute for it, so it hands the status to wait() and
+ *                 gives the processor away for good.
+ *   INPUTS:       status - halt status
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: context switch
+ */
+static void spawned_exit(int32_t status) {
+    uint32_t parent = processes[CPID].PPID;
+    uint8_t terminal = processes[CPID].terminal;
+
+    processes[CPID].active = 0;
+    processes[CPID].exit_status = status;
+    if (parent == 0) {
+        // orphan, nobody will wait for it
+        processes[CPID].spawned = 0;
+        processes[CPID].running = 0;
+    } else {
+        if (active_processes[terminal] == CPID) {
+            active_processes[terminal] = parent;
+        }
+        processes[CPID].zombie = 1;
+        task_wake(parent);
+    }
+    task_switch();
+}
+
+/*
+ * clone
+ *   DESCRIPTION:  Starts a thread: a new task that shares the caller's page
+ *                 directory and file descriptors but has its own kernel stack
+ *                 and runs on a user stack of the caller's choosing. Halting a
+ *                 thread ends only that thread; halting the main thread (the
+ *                 one execute started) ends the whole process.
+ *   INPUTS:       entry - user address the thread starts at
+ *                 stack - initial user esp of the thread
+ *   OUTPUTS:      none
+ *   RETURN VALUE: PID of the thread, -1 if not successful
+ *   SIDE EFFECTS: Overwrites PCB structs
+ */
+int32_t clone (uint32_t entry, uint32_t stack) {
+    uint32_t PID;
+    uint32_t leader = processes[CPID].tgid;
+
+    if (!user_range_ok(entry, 1) || !user_range_ok(stack - 4, 4)) {
+        return -1;
+    }
+
+    cli();
+    for (PID = 1; PID <= MAX_PROCESSES && processes[PID].running; PID++);
+    if (PID > MAX_PROCESSES) {
+        sti();
+        return -1;
+    }
+
+    processes[PID].PID = PID;
+    processes[PID].PPID = leader;
+    processes[PID].tgid = leader;
+    processes[PID].files = processes[leader].files;
+    processes[PID].running = 1;
+
+    memcpy(processes[PID].args, processes[leader].args, processes[leader].args_size + 1);
+    processes[PID].args_size = processes[leader].args_size;
+
+    processes[PID].terminal = processes[CPID].terminal;
+    processes[PID].using_video_mem = processes[CPID].using_video_mem;
+    processes[PID].using_ring = 0;
+    processes[PID].spawned = 0;
+    processes[PID].zombie = 0;
+    processes[PID].killed = 0;
+    signal_task_init(PID);
+    processes[PID].sleeping = 0;
+    timer_setup(&processes[PID].sleep_timer, timer_wakeup, PID);
+    share_page_directory(PID, leader);
+
+    /* task_switch starts it in user space the first time it is picked */
+    processes[PID].entry = entry;
+    processes[PID].user_stack = stack;
+    processes[PID].esp_switch = 0;
+    processes[PID].active = 1;
+
+    pit_update();
+    sti();
+    return PID;
+}
+
+/*
+ * task_cleanup
+ *   DESCRIPTION:  Drops everything a task holds besides its files: timers,
+ *                 signals, shared memory, futex and IPC waits, and its hold on
+ *                 the page directory
+ *   INPUTS:       PID of the task
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void task_cleanup(uint32_t PID) {
+    timer_cancel(&processes[PID].sleep_timer);
+    signal_task_exit(PID);
+    shm_task_exit(PID);
+    futex_task_exit(PID);
+    ipc_task_exit(PID);
+    release_page_directory(PID);
+}
+
+/*
+ * thread_exit
+ *   DESCRIPTION:  Ends the current task, which is a thread, for good. The
+ *                 process's files and memory stay with the main thread.
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: context switch
+ */
+static void thread_exit(void) {
+    task_cleanup(CPID);
+    processes[CPID].active = 0;
+    processes[CPID].running = 0;
+    task_switch();
+}
+
+/*
+ * kill_threads
+ *   DESCRIPTION:  Ends every other thread of a process whose main thread is
+ *                 halting. They are all off the processor, so their kernel
+ *                 stacks are simply abandoned.
+ *   INPUTS:       PID of the main thread
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void kill_threads(uint32_t PID) {
+    uint32_t i;
+
+    for (i = 1; i <= MAX_PROCESSES; i++) {
+        if (i != PID && processes[i].running && processes[i].tgid == PID) {
+            task_cleanup(i);
+            processes[i].active = 0;
+            processes[i].running = 0;
+        }
+    }
 }
 
 /*
@@ -533,10 +1361,10 @@ int32_t execute (int8_t* command) {
  *   SIDE EFFECTS: Can overwrite different buffers depending on which jump table is used
  */
 int32_t read (int32_t fd, void* buf, int32_t nbytes) {
-    if (fd < 0 || fd >= MAX_FD || processes[CPID].fd_array[fd].flags.in_use == 0)
+    if (fd < 0 || fd >= MAX_FD || processes[CPID].files[fd].flags.in_use == 0)
         return -1;
 
-    return processes[CPID].fd_array[fd].jumptable->read(&processes[CPID].fd_array[fd], buf, nbytes);
+    return processes[CPID].files[fd].jumptable->read(&processes[CPID].files[fd], buf, nbytes);
 }
 
 /*
@@ -550,10 +1378,10 @@ int32_t read (int32_t fd, void* buf, int32_t nbytes) {
  *   SIDE EFFECTS: Can overwrite different buffers depending on which jump table is used
  */
 int32_t write (int32_t fd, void* buf, int32_t nbytes) {
-    if (fd < 0 || fd >= MAX_FD || processes[CPID].fd_array[fd].flags.in_use == 0)
+    if (fd < 0 || fd >= MAX_FD || processes[CPID].files[fd].flags.in_use == 0)
         return -1;
 
-    return processes[CPID].fd_array[fd].jumptable->write(&processes[CPID].fd_array[fd], buf, nbytes);
+    return processes[CPID].files[fd].jumptable->write(&processes[CPID].files[fd], buf, nbytes);
 }
 
 /*
@@ -577,22 +1405,22 @@ int32_t open (const int8_t* filename) {
 
     /* Check for non-used file descriptors and populate one FD with the file info */
     for (i = 0; i < MAX_FD; i++) {
-        if (processes[CPID].fd_array[i].flags.in_use == 0) {
+        if (processes[CPID].files[i].flags.in_use == 0) {
             if (dentry.type == 0) {
-                processes[CPID].fd_array[i].jumptable = &rtc_jumptable;
+                processes[CPID].files[i].jumptable = &rtc_jumptable;
             } else {
-                processes[CPID].fd_array[i].jumptable = &fs_jumptable;
+                processes[CPID].files[i].jumptable = &fs_jumptable;
             }
 
-            if (processes[CPID].fd_array[i].jumptable->open())
+            processes[CPID].files[i].inode = dentry.inode;
+            if (processes[CPID].files[i].jumptable->open(&processes[CPID].files[i]))
                 return -1;
 
-            processes[CPID].fd_array[i].inode = dentry.inode;
-            processes[CPID].fd_array[i].position = 0;
-            processes[CPID].fd_array[i].filetype = dentry.type;
-            processes[CPID].fd_array[i].flags.read_only = 1;
-            processes[CPID].fd_array[i].flags.write_only = 0;
-            processes[CPID].fd_array[i].flags.in_use = 1;
+            processes[CPID].files[i].position = 0;
+            processes[CPID].files[i].filetype = dentry.type;
+            processes[CPID].files[i].flags.read_only = 1;
+            processes[CPID].files[i].flags.write_only = 0;
+            processes[CPID].files[i].flags.in_use = 1;
             return i;
         }
     }
@@ -612,12 +1440,12 @@ int32_t open (const int8_t* filename) {
 int32_t close (int32_t fd) {
 
     /* The user should not be able to close FD 0 or 1 */
-    if (fd < 2 || fd >= MAX_FD || processes[CPID].fd_array[fd].flags.in_use == 0)
+    if (fd < 2 || fd >= MAX_FD || processes[CPID].files[fd].flags.in_use == 0)
         return -1;
 
-    processes[CPID].fd_array[fd].flags.in_use = 0;
+    processes[CPID].files[fd].flags.in_use = 0;
 
-    return processes[CPID].fd_array[fd].jumptable->close(&processes[CPID].fd_array[fd]);
+    return processes[CPID].files[fd].jumptable->close(&processes[CPID].files[fd]);
 }
 
 /*
@@ -653,34 +1481,21 @@ int32_t vidmap (uint8_t** screenstart) {
         return -1;
     }
 
-    if ((int32_t) screenstart > (USER_PAGE_BOTTOM-4) || (int32_t) screenstart < PROGRAM_IMAGE) {
+    if (!user_range_ok((uint32_t) screenstart, sizeof(uint8_t*))) {
         return -1;
     }
 
-    processes[CPID].using_video_mem = 1;
-
     uint32_t user_video_addr = USER_PAGE_BOTTOM;
+    uint32_t flags;
 
-    // map to correct video memory
-    if (processes[CPID].terminal == cur_terminal) {
-        if (new_page_directory_entry(CPID, user_video_addr, VIDEO, 0, 3)) {
-            return -1;
-        }
-    } else {
-        if (processes[CPID].terminal == 0) {
-            if (new_page_directory_entry(CPID, user_video_addr, VIDEO_0, 0, 3)) {
-                return -1;
-            }
-        } else if (processes[CPID].terminal == 1) {
-            if (new_page_directory_entry(CPID, user_video_addr, VIDEO_1, 0, 3)) {
-                return -1;
-            }
-        } else if (processes[CPID].terminal == 2) {
-            if (new_page_directory_entry(CPID, user_video_addr, VIDEO_2, 0, 3)) {
-                return -1;
-            }
-        }
+    // map to correct video memory, terminal_switch keeps it that way from now on
+    cli_and_save(flags);
+    if (new_page_directory_entry(CPID, user_video_addr, vidmap_page(CPID), 0, 3)) {
+        restore_flags(flags);
+        return -1;
     }
+    processes[CPID].using_video_mem = 1;
+    restore_flags(flags);
 
     *screenstart = (uint8_t *) user_video_addr;
 
@@ -688,25 +1503,41 @@ int32_t vidmap (uint8_t** screenstart) {
 }
 
 /*
- * set_handler
- *   DESCRIPTION:  does nothing
+ * vidmap_refresh
+ *   DESCRIPTION:  points every vidmap at the right video memory after the
+ *                 visible terminal changed: the screen for programs on the
+ *                 visible terminal, their terminal's backing page for the rest
  *   INPUTS:       none
  *   OUTPUTS:      none
- *   RETURN VALUE: -1
- *   SIDE EFFECTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes page directories
  */
-int32_t set_handler (int32_t signum, void* handler_address) {
-    return -1;
+void vidmap_refresh() {
+    uint32_t i;
+    uint32_t flags;
+
+    cli_and_save(flags);
+    for (i = 1; i <= MAX_PROCESSES; i++) {
+        if (processes[i].running && processes[i].using_video_mem) {
+            new_page_directory_entry(i, USER_PAGE_BOTTOM, vidmap_page(i), 0, 3);
+        }
+    }
+    restore_flags(flags);
 }
 
 /*
- * sigreturn
- *   DESCRIPTION:  does nothing
- *   INPUTS:       none
+ * vidmap_page
+ *   DESCRIPTION:  picks the video memory a process's vidmap should show
+ *   INPUTS:       PID of the process
  *   OUTPUTS:      none
- *   RETURN VALUE: -1
+ *   RETURN VALUE: physical address of the page
  *   SIDE EFFECTS: none
  */
-int32_t sigreturn (void) {
-    return -1;
+static uint32_t vidmap_page(uint32_t PID) {
+    static const uint32_t backing[NUM_TERMINALS] = {VIDEO_0, VIDEO_1, VIDEO_2};
+
+    if (processes[PID].terminal == cur_terminal) {
+        return VIDEO;
+    }
+    return backing[processes[PID].terminal];
 }
@@ -5,10 +5,15 @@
 #include "filesys.h"
 #include "rtc.h"
 #include "terminal.h"
+#include "timer.h"
+#include "signal.h"
+#include "smp.h"
 
 #define MAX_FD        8
 #define MAX_PROCESSES 6
 #define NUM_TERMINALS 3
+#define MAX_KTHREADS  (1 + MAX_CPUS) // the workqueue worker and one idle thread per CPU
+#define NUM_TASKS     (MAX_PROCESSES + 1 + MAX_KTHREADS) // kernel threads use the PCBs after the processes
 
 
 /*
@@ -24,6 +29,23 @@
  *  ebp: Value of EBP before context switch
  *  running: Boolean to determine if the process is running or not
  *  tss_esp0: Value of ESP0 to store in TSS
+ *  kthread: Boolean, 1 if this is a kernel thread instead of a user process
+ *  sleeping: Boolean, 1 if the task is blocked and should not be scheduled
+ *  kthread_func: Body of a kernel thread
+ *  sleep_timer: Timer wheel entry that wakes the task up from nanosleep
+ *  using_ring: Boolean, 1 once the process has mapped its syscall ring
+ *  sig_handlers: User handler for each signal, NULL for the default action
+ *  sig_pending: Bitmask of signals waiting to be delivered
+ *  sig_masked: Boolean, 1 while a handler runs (until sigreturn)
+ *  alarm_timer: Timer wheel entry that sends ALARM
+ *  spawned: Boolean, 1 if started by spawn (runs next to its parent, collected by wait)
+ *  zombie: Boolean, 1 once a spawned process halted and is waiting to be collected
+ *  exit_status: Halt status of a zombie
+ *  entry: User entry point of a spawned process or thread that has not run yet
+ *  user_stack: User stack pointer it starts with
+ *  tgid: PID of the main thread of the process, the PCB's own PID unless it is a thread
+ *  files: File descriptor array in use, the main thread's fd_array for a thread
+ *  killed: Boolean, 1 if another thread of the process died by exception
  */
 
 typedef struct {
@@ -41,19 +63,50 @@ typedef struct {
 	uint8_t active;
 	uint8_t terminal; // 0-2
 	uint8_t using_video_mem;
+	uint8_t kthread;
+	uint8_t sleeping;
+	void (*kthread_func)(void);
+	ktimer_t sleep_timer;
+	uint8_t using_ring;
+	void* sig_handlers[NUM_SIGNALS];
+	uint32_t sig_pending;
+	uint8_t sig_masked;
+	ktimer_t alarm_timer;
+	uint8_t spawned;
+	uint8_t zombie;
+	int32_t exit_status;
+	uint32_t entry;
+	uint32_t user_stack;
+	uint32_t tgid;
+	file_t* files;
+	uint8_t killed;
 } pcb_t;
 
-extern uint32_t CPID;
-extern pcb_t processes[MAX_PROCESSES + 1];
+extern uint32_t cpu_task[MAX_CPUS];
+extern pcb_t processes[NUM_TASKS];
 extern uint32_t active_processes[NUM_TERMINALS];
 extern uint8_t needs_to_be_halted[NUM_TERMINALS];
+extern uint8_t needs_base_shell[NUM_TERMINALS];
+extern int32_t cpu_idle[MAX_CPUS];
+extern volatile uint8_t need_resched;
+
+#define CPID     (cpu_task[this_cpu()]) // task running on this CPU
+#define idle_PID (cpu_idle[this_cpu()]) // this CPU's idle thread
 
 extern void syscalls_init();
 extern void task_switch();
+extern void task_sleep();
+extern void task_wake(uint32_t PID);
+extern void task_handoff(uint32_t PID);
+extern int32_t runnable_tasks();
+extern int32_t tasks_waiting();
+extern void task_cpu_init(void);
+extern void task_video_context(uint32_t PID);
 extern int execute_base_shell(unsigned char terminal);
 extern void kernel_to_user(uint32_t user_entry);
 extern void haltasm(int32_t ebp, int32_t esp, uint32_t PPID);
 extern int32_t exception_halt ();
+extern int32_t interrupt_pipeline(uint32_t PID);
 
 // System Calls
 extern int32_t halt (uint8_t status);
@@ -64,7 +117,9 @@ extern int32_t open (const int8_t* filename);
 extern int32_t close (int32_t fd);
 extern int32_t getargs (int8_t* buf, int32_t nbytes);
 extern int32_t vidmap (uint8_t** screenstart);
-extern int32_t set_handler (int32_t signum, void* handler_address);
-extern int32_t sigreturn (void);
+extern void vidmap_refresh();
+extern int32_t spawn (int8_t* command, int32_t fd_in, int32_t fd_out);
+extern int32_t wait (int32_t pid);
+extern int32_t clone (uint32_t entry, uint32_t stack);
 
 #endif
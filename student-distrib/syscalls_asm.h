@@ -4,7 +4,9 @@
 #define SYSCALLS_ASM_H
 
 extern void syscall_wrapper();
+extern void sysenter_wrapper();
 extern void kernel_to_user(uint32_t entry);
+extern void kernel_to_user_stack(uint32_t entry, uint32_t esp);
 extern void haltasm(int32_t ebp, int32_t esp, uint32_t ret);
 
 #endif
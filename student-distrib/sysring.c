@@ -0,0 +1,129 @@
+// sysring.c
+// batched system calls through a submission and a completion ring in a page
+// shared with the process. ring_enter works through everything that has been
+// queued in a single trap, so chatty programs pay for one kernel entry per batch
+// instead of one per read or write.
+
+#include "sysring.h"
+#include "syscalls.h"
+#include "paging.h"
+#include "lib.h"
+
+// GLOBAL VARIABLES
+// each ring padded to a whole page, so the page mapped at RING_ADDR holds exactly one ring
+static union {
+    sysring_t ring;
+    uint8_t page[4096];
+} rings[MAX_PROCESSES + 1] __attribute__((aligned(4096))); // indexed by PID
+
+// fails to compile if a ring outgrows its page
+typedef char sysring_fits_page[(sizeof(sysring_t) <= 4096) ? 1 : -1];
+
+// FUNCTION DECLARATIONS
+int32_t ring_setup(sysring_t** ring);
+int32_t ring_enter(void);
+static int32_t ring_do(ring_sqe_t* sqe);
+
+// GLOBAL FUNCTIONS
+/*
+ * ring_setup
+ *   DESCRIPTION:  maps the calling process's ring page at RING_ADDR, empty
+ *   INPUTS:       ring - where to store the user address of the ring
+ *   OUTPUTS:      address of the ring
+ *   RETURN VALUE: 0 if successful, -1 if not
+ *   SIDE EFFECTS: changes the process's page tables
+ */
+int32_t ring_setup(sysring_t** ring) {
+    sysring_t* r = &rings[processes[CPID].tgid].ring;
+
+    if (ring == NULL || !user_range_ok((uint32_t) ring, sizeof(sysring_t*))) {
+        return -1;
+    }
+
+    r->sq_head = 0;
+    r->sq_tail = 0;
+    r->cq_head = 0;
+    r->cq_tail = 0;
+
+    if (new_page_directory_entry(CPID, RING_ADDR, (uint32_t) r, 0, 3)) {
+        return -1;
+    }
+    processes[CPID].using_ring = 1;
+
+    *ring = (sysring_t*) RING_ADDR;
+    return 0;
+}
+
+/*
+ * ring_enter
+ *   DESCRIPTION:  runs every queued submission in order, posting a completion for
+ *                 each. Stops early if the completion ring fills up; whatever is
+ *                 left stays queued for the next call.
+ *   INPUTS:       none
+ *   OUTPUTS:      completions in the ring
+ *   RETURN VALUE: number of submissions run, -1 if the ring isn't set up
+ *   SIDE EFFECTS: whatever the queued calls do, reads may block
+ */
+int32_t ring_enter(void) {
+    sysring_t* r = &rings[processes[CPID].tgid].ring;
+    uint32_t tail;
+    int32_t done = 0;
+
+    if (!processes[CPID].using_ring) {
+        return -1;
+    }
+
+    tail = r->sq_tail;
+    // a bogus tail from the process can't make us run more than a ring's worth
+    if (tail - r->sq_head > RING_ENTRIES) {
+        return -1;
+    }
+
+    while (r->sq_head != tail && r->cq_tail - r->cq_head < RING_ENTRIES) {
+        ring_sqe_t* sqe = &r->sq[r->sq_head & (RING_ENTRIES - 1)];
+        ring_cqe_t* cqe = &r->cq[r->cq_tail & (RING_ENTRIES - 1)];
+
+        cqe->user_data = sqe->user_data;
+        cqe->result = ring_do(sqe);
+        r->sq_head++;
+        r->cq_tail++;
+        done++;
+    }
+
+    return done;
+}
+
+// LOCAL FUNCTIONS
+/*
+ * ring_do
+ *   DESCRIPTION:  runs one submission through the normal system call
+ *   INPUTS:       sqe - the submission
+ *   OUTPUTS:      none
+ *   RETURN VALUE: the system call's return value, -1 for a bad entry
+ *   SIDE EFFECTS: whatever the call does
+ */
+static int32_t ring_do(ring_sqe_t* sqe) {
+    ring_sqe_t e = *sqe; // the process can keep writing the ring while we work
+
+    switch (e.opcode) {
+        case RING_OP_READ:
+            if (e.nbytes < 0 || !user_range_ok(e.buf, e.nbytes)) {
+                return -1;
+            }
+            return read(e.fd, (void*) e.buf, e.nbytes);
+        case RING_OP_WRITE:
+            if (e.nbytes < 0 || !user_range_ok(e.buf, e.nbytes)) {
+                return -1;
+            }
+            return write(e.fd, (void*) e.buf, e.nbytes);
+        case RING_OP_OPEN:
+            if (!user_range_ok(e.buf, 1)) {
+                return -1;
+            }
+            return open((const int8_t*) e.buf);
+        case RING_OP_CLOSE:
+            return close(e.fd);
+        default:
+            return -1;
+    }
+}
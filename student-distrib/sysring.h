@@ -0,0 +1,50 @@
+// sysring.h
+
+#ifndef SYSRING_H
+#define SYSRING_H
+
+#include "types.h"
+
+#define RING_ENTRIES 128 // power of two, indices are masked with RING_ENTRIES-1
+#define RING_ADDR    0x09401000 // one page above the vidmap page
+
+// opcodes are the matching system call numbers
+#define RING_OP_READ  3
+#define RING_OP_WRITE 4
+#define RING_OP_OPEN  5
+#define RING_OP_CLOSE 6
+
+// submission entry, filled in by the process
+typedef struct {
+    uint32_t opcode;
+    int32_t fd;
+    uint32_t buf;      // buffer for read/write, filename for open
+    int32_t nbytes;
+    uint32_t user_data; // copied to the completion untouched
+} ring_sqe_t;
+
+// completion entry, filled in by the kernel
+typedef struct {
+    uint32_t user_data;
+    int32_t result;    // what the system call would have returned
+} ring_cqe_t;
+
+/*
+ * Page shared by the kernel and a process. The process produces at sq_tail and
+ * consumes at cq_head, the kernel consumes at sq_head and produces at cq_tail.
+ * Indices count up forever and are masked when used.
+ */
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    ring_sqe_t sq[RING_ENTRIES];
+    ring_cqe_t cq[RING_ENTRIES];
+} sysring_t;
+
+// System Calls
+extern int32_t ring_setup(sysring_t** ring);
+extern int32_t ring_enter(void);
+
+#endif
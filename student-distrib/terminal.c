@@ -3,6 +3,8 @@
 #include "terminal.h"
 #include "i8259.h"
 #include "syscalls.h"
+#include "workqueue.h"
+#include "vdso.h"
 
 
 /* Local variables by group OScelot */
@@ -17,14 +19,17 @@ terminal_t* t; // shortcut for terminal[cur_terminal]
 
 /* Local functions by group OScelot */
 void terminal_switch(int new_terminal);
+void keyboard_bottom_half(uint32_t scancode);
 void do_reg(uint8_t scancode);
 void do_spec(uint8_t scancode);
+static void wake_readers(terminal_t* term);
 
 void terminal_init(int num) {
     terminal[num].kbd_is_read = 0;
     terminal[num].buf_pos = 0;
     terminal[num].pos.x = 0;
     terminal[num].pos.y = 0;
+    terminal[num].readers = 0;
 
     /* Initialize terminal attribute colors */
     set_attribute(ATTRIB_0, 0);
@@ -34,19 +39,35 @@ void terminal_init(int num) {
 
 /*
  * keyboardHandler
- *   DESCRIPTION:  Handler for keyboard interrupts
- *   INPUTS:       none
+ *   DESCRIPTION:  Handler for keyboard interrupts. Only grabs the scancode, the
+ *                 rest is done by keyboard_bottom_half in the worker thread.
+ *   INPUTS:       frame - unused
  *   OUTPUTS:      none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Writes to the terminal buffer
+ *   SIDE EFFECTS: Queues deferred work
  */
-void keyboardHandler(void) {
+void keyboardHandler(hw_context_t* frame) {
     uint8_t  scancode;
-    uint8_t  key_released_code;
 
-    disable_irq(KEYBOARD_IRQ_NUM);
+    /* Receive data from the keyboard */
+    scancode = inb(KEYBOARD_DATA);
 
-    cli();
+    schedule_work(keyboard_bottom_half, scancode);
+}
+
+/*
+ * keyboard_bottom_half
+ *   DESCRIPTION:  Handles a scancode captured by keyboardHandler. Runs in the
+ *                 worker thread with interrupts enabled.
+ *   INPUTS:       scancode - scancode read from the keyboard
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Writes to the terminal buffer
+ */
+void keyboard_bottom_half(uint32_t scancode) {
+    uint8_t  key_released_code;
+    uint32_t fg;
+    int32_t pipeline;
 
     // set shortcut t
     t = &terminal[cur_terminal];
@@ -54,9 +75,6 @@ void keyboardHandler(void) {
     // write to the visible video memory
     set_video_context(ACTIVE_CONTEXT);
 
-    /* Receive data from the keyboard */
-    scancode = inb(KEYBOARD_DATA);
-
     /* Calculate the release code by OR'ing with 0x80 */
     key_released_code = scancode | KEYBOARD_MASK;
 
@@ -105,8 +123,6 @@ void keyboardHandler(void) {
     // handles special key combo of ALT-F1/F2/F3
     if (alt_active && scancode == F1) {
         // doesn't need an error check
-        send_eoi(KEYBOARD_IRQ_NUM);
-        enable_irq(KEYBOARD_IRQ_NUM);
         terminal_switch(0);
         return;
     }
@@ -120,8 +136,6 @@ void keyboardHandler(void) {
             }
         }
         if (active_processes[1] != 0 || process_available) {
-            send_eoi(KEYBOARD_IRQ_NUM);
-            enable_irq(KEYBOARD_IRQ_NUM);
             terminal_switch(1);
             return;
         }
@@ -137,14 +151,25 @@ void keyboardHandler(void) {
         }
 
         if (active_processes[2] != 0 || process_available) {
-            send_eoi(KEYBOARD_IRQ_NUM);
-            enable_irq(KEYBOARD_IRQ_NUM);
             terminal_switch(2);
             return;
         }
     }
 
     if (ctrl_active && scancode == C) {
+        fg = active_processes[cur_terminal];
+        pipeline = fg != 0 && processes[fg].spawned && processes[fg].PPID != 0;
+
+        /* Processes with an INTERRUPT handler deal with CTRL-C themselves,
+         * a pipeline halts its other stages too and its shell stays */
+        if (pipeline) {
+            if (interrupt_pipeline(fg) == 0) {
+                return;
+            }
+        } else if (signal_send(fg, INTERRUPT) == 0) {
+            return;
+        }
+
         clear();
 
         /* Reset buffer position to (0, 0) */
@@ -154,13 +179,10 @@ void keyboardHandler(void) {
         /* Clear the whole buffer */
         t->buf_pos = 0;
 
-        if (CPID == active_processes[cur_terminal]) {
-            send_eoi(KEYBOARD_IRQ_NUM);
-            enable_irq(KEYBOARD_IRQ_NUM);
-            exception_halt();
-        } else {
-            // so that the process in the current terminal is halted next time it receives processor time
+        // so that the process in the current terminal is halted next time it receives processor time
+        if (!pipeline) {
             needs_to_be_halted[cur_terminal] = 1;
+            task_wake(fg);
         }
 
     /* Handles the special key combo of CTRL-L which
@@ -182,18 +204,6 @@ void keyboardHandler(void) {
 
     /* Move cursor to the right spot */
     set_cursor(0);
-
-    // adjust video memory back to what it was
-    if (processes[CPID].terminal == cur_terminal) {
-        set_video_context(ACTIVE_CONTEXT);
-    } else {
-        set_video_context(processes[CPID].terminal);
-    }
-
-    /* Send EOI and enable the keyboard IRQ again so we keep getting keys */
-    send_eoi(KEYBOARD_IRQ_NUM);
-    enable_irq(KEYBOARD_IRQ_NUM);
-    sti();
 }
 
 /*
@@ -211,6 +221,7 @@ void terminal_switch(int new_terminal) {
 
     int old_terminal = cur_terminal;
     cur_terminal = new_terminal;
+    vdso->cur_terminal = cur_terminal;
 
     // save anything we need, restore new cursor and color
     // terminal[old_terminal].pos = get_pos();
@@ -218,30 +229,22 @@ void terminal_switch(int new_terminal) {
     // set_pos(terminal[new_terminal].pos.x, terminal[new_terminal].pos.y);
     set_cursor(0);
 
-    // check if we need to load the base shell
+    // check if we need to load the base shell, task_switch launches it once the
+    // worker thread gives up the processor
     if (active_processes[cur_terminal] == 0) {
         save_video_context(old_terminal);
         set_video_context(ACTIVE_CONTEXT);
         clear();
-
-        int old_esp, old_ebp;
-        __asm__("movl %%esp, %0; movl %%ebp, %1"
-                 :"=g"(old_esp), "=g"(old_ebp) /* outputs */
-                );
-        processes[CPID].esp_switch = old_esp;
-        processes[CPID].ebp_switch = old_ebp;
-        execute_base_shell(cur_terminal);
+        vidmap_refresh();
+        needs_base_shell[cur_terminal] = 1;
         return;
     }
 
-    // adjust video memory
+    // adjust video memory (task_switch picks the right context for whichever
+    // process runs next) and the vidmaps of programs that see it
     save_video_context(old_terminal);
     load_video_context(cur_terminal);
-    if (processes[CPID].terminal == cur_terminal) {
-        set_video_context(ACTIVE_CONTEXT);
-    } else {
-        set_video_context(processes[CPID].terminal);
-    }
+    vidmap_refresh();
 }
 
 /*
@@ -334,6 +337,7 @@ void do_spec(uint8_t scancode) {
             putc('\n');
             /* Set kbd_is_read flag so we know it can be read */
             t->kbd_is_read = 1;
+            wake_readers(t);
             break;
 
         case BACKSPACE:
@@ -408,10 +412,15 @@ int32_t terminal_read(file_t * file, uint8_t * buf, int32_t nbytes) {
     int32_t  i = 0;          /* Loop counter         */
     int32_t  num_bytes = 0;  /* Number of bytes read */
 
-    /* Spin until ENTER is pressed */
+    /* Sleep until ENTER is pressed */
+    cli();
     while (terminal[processes[CPID].terminal].kbd_is_read == 0) {
-        sti();
+        terminal[processes[CPID].terminal].readers |= 1 << CPID;
+        task_sleep();
+        cli();
     }
+    terminal[processes[CPID].terminal].readers &= ~(1 << CPID);
+    sti();
 
     /* Whatever is in the terminal buffer goes into the input buffer */
     while (i < nbytes && i <= terminal[processes[CPID].terminal].buf_pos) {
@@ -432,11 +441,11 @@ int32_t terminal_read(file_t * file, uint8_t * buf, int32_t nbytes) {
 /*
  * terminal_open
  *   DESCRIPTION:  System call that opens the filename. Not used by terminal.
- *   INPUTS:       filename - name of file to open
+ *   INPUTS:       file - unused
  *   OUTPUTS:      none
  *   RETURN VALUE: -1
  */
-int32_t terminal_open() {
+int32_t terminal_open(file_t* file) {
     return -1;
 }
 
@@ -450,3 +459,24 @@ int32_t terminal_open() {
 int32_t terminal_close(file_t * file) {
     return -1;
 }
+
+/*
+ * wake_readers
+ *   DESCRIPTION:  Wakes every task sleeping in terminal_read on a terminal.
+ *                 The first one to run takes the line, the rest sleep again.
+ *   INPUTS:       term - the terminal
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none
+ */
+static void wake_readers(terminal_t* term) {
+    uint32_t PID;
+    uint32_t mask = term->readers;
+
+    term->readers = 0;
+    for (PID = 1; mask; PID++) {
+        if (mask & (1 << PID)) {
+            mask &= ~(1 << PID);
+            task_wake(PID);
+        }
+    }
+}
@@ -5,6 +5,7 @@
 #include "types.h"
 #include "lib.h"
 #include "filesys.h"
+#include "signal.h"
 
 /* Custom defines added by group OScelot */
 #define KEYBOARD_DATA 0x60
@@ -38,17 +39,18 @@ typedef struct {
     char buffer[BUFFER_SIZE];          // Keyboard buffer
     int buf_pos;                       // Current buffer position
     pos_t pos;                         // pos_t struct to hold the coordinates when changing terminals
+    uint32_t readers;                  // bit n set if PID n sleeps in terminal_read
 } terminal_t;
 
 extern int cur_terminal;
 
 /* Function Declarations */
-void keyboardHandler();
+void keyboardHandler(hw_context_t* frame);
 void terminal_init();
 
 extern int32_t terminal_write(file_t * file, uint8_t  * buf, int32_t nbytes);
 extern int32_t terminal_read(file_t * file, uint8_t * buf, int32_t nbytes);
-extern int32_t terminal_open();
+extern int32_t terminal_open(file_t* file);
 extern int32_t terminal_close(file_t * file);
 
 
@@ -0,0 +1,274 @@
+// timer.c
+// hierarchical timer wheel driven by the PIT
+// four levels of 64 slots; level 0 holds timers due in the next 64 ticks, each
+// level above covers 64 times the range of the one below and gets cascaded down
+// a slot at a time as the lower level wraps. Adding and cancelling a timer is
+// a list insert/unlink, and each tick only looks at one slot per level.
+
+#include "timer.h"
+#include "clock.h"
+#include "lib.h"
+#include "syscalls.h"
+
+// GLOBAL VARIABLES
+static ktimer_t wheel[TIMER_LEVELS][TIMER_SLOTS]; // list heads, circular with the head as sentinel
+static uint32_t timer_jiffies = 0; // next tick the wheel has to process
+static uint32_t timers_pending = 0;
+
+// FUNCTION DECLARATIONS
+void timer_init(void);
+uint32_t timer_now(void);
+void timer_setup(ktimer_t* timer, timer_func_t func, uint32_t arg);
+void timer_add(ktimer_t* timer, uint32_t expires);
+void timer_cancel(ktimer_t* timer);
+void timer_run(void);
+int32_t timer_next_expiry(uint32_t* expiry);
+void timer_wakeup(uint32_t PID);
+static void internal_add(ktimer_t* timer);
+static void unlink(ktimer_t* timer);
+static uint32_t cascade(uint32_t level, uint32_t index);
+
+// GLOBAL FUNCTIONS
+/*
+timer_init
+    DESCRIPTION: empties the wheel and syncs it with the clock
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: needs clock_init first
+*/
+void timer_init(void) {
+    int i, j;
+    for (i = 0; i < TIMER_LEVELS; i++) {
+        for (j = 0; j < TIMER_SLOTS; j++) {
+            wheel[i][j].next = &wheel[i][j];
+            wheel[i][j].prev = &wheel[i][j];
+        }
+    }
+    timers_pending = 0;
+    timer_jiffies = timer_now();
+}
+
+/*
+timer_now
+    DESCRIPTION: current wheel tick according to the monotonic clock
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: milliseconds since boot
+*/
+uint32_t timer_now(void) {
+    return (uint32_t)div64_32(clock_ns(), TIMER_TICK_NS, NULL);
+}
+
+/*
+timer_setup
+    DESCRIPTION: fills in a timer before its first use
+    INPUTS: timer - the timer
+            func - action to run when it fires
+            arg - argument for func
+    OUTPUTS: none
+    RETURNS: none
+*/
+void timer_setup(ktimer_t* timer, timer_func_t func, uint32_t arg) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->func = func;
+    timer->arg = arg;
+    timer->pending = 0;
+}
+
+/*
+timer_add
+    DESCRIPTION: arms a timer (re-arms it if it is already pending)
+    INPUTS: timer - the timer, set up with timer_setup
+            expires - wheel tick to fire on, e.g. timer_now() + delay in ms.
+                      Ticks already in the past fire on the next PIT interrupt,
+                      ones more than TIMER_MAX_DELAY ahead are pulled in to that
+                      (timer->expires says which tick it really got).
+    OUTPUTS: none
+    RETURNS: none
+*/
+void timer_add(ktimer_t* timer, uint32_t expires) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (timer->pending) {
+        unlink(timer);
+    }
+    timer->expires = expires;
+    internal_add(timer);
+    restore_flags(flags);
+}
+
+/*
+timer_cancel
+    DESCRIPTION: disarms a timer, does nothing if it isn't pending
+    INPUTS: timer - the timer
+    OUTPUTS: none
+    RETURNS: none
+*/
+void timer_cancel(ktimer_t* timer) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (timer->pending) {
+        unlink(timer);
+    }
+    restore_flags(flags);
+}
+
+/*
+timer_run
+    DESCRIPTION: advances the wheel up to the current tick and runs every timer
+                 that expired on the way. Called from pitHandler.
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: interrupts must be off
+*/
+void timer_run(void) {
+    uint32_t now = timer_now();
+
+    // nothing armed, the wheel can jump straight to now
+    if (timers_pending == 0) {
+        timer_jiffies = now + 1;
+        return;
+    }
+
+    while ((int32_t)(now - timer_jiffies) >= 0) {
+        uint32_t index = timer_jiffies & TIMER_SLOT_MASK;
+        ktimer_t* head = &wheel[0][index];
+
+        // level 0 wrapped, pull the next slot of each level above down
+        if (!index &&
+                !cascade(1, (timer_jiffies >> TIMER_SLOT_BITS) & TIMER_SLOT_MASK) &&
+                !cascade(2, (timer_jiffies >> (2 * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK)) {
+            cascade(3, (timer_jiffies >> (3 * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK);
+        }
+        timer_jiffies++;
+
+        while (head->next != head) {
+            ktimer_t* timer = head->next;
+            unlink(timer);
+            timer->func(timer->arg);
+        }
+    }
+}
+
+/*
+timer_next_expiry
+    DESCRIPTION: tick the PIT should be programmed for. This is the first busy
+                 level 0 slot, or the next level 0 wrap (where higher levels
+                 cascade) if there is none, so it may be early but never late.
+    INPUTS: none
+    OUTPUTS: expiry - the wheel tick
+    RETURNS: 0 if successful, -1 if no timers are armed
+*/
+int32_t timer_next_expiry(uint32_t* expiry) {
+    uint32_t tick;
+
+    if (timers_pending == 0) {
+        return -1;
+    }
+
+    for (tick = timer_jiffies; ; tick++) {
+        // level 0 wraps here, higher levels have to be cascaded
+        if ((tick & TIMER_SLOT_MASK) == 0) {
+            break;
+        }
+        if (wheel[0][tick & TIMER_SLOT_MASK].next != &wheel[0][tick & TIMER_SLOT_MASK]) {
+            break;
+        }
+    }
+    *expiry = tick;
+    return 0;
+}
+
+/*
+timer_wakeup
+    DESCRIPTION: timer action that makes a sleeping task runnable. pitHandler
+                 takes care of switching to it if the CPU was idle.
+    INPUTS: PID of the task
+    OUTPUTS: none
+    RETURNS: none
+*/
+void timer_wakeup(uint32_t PID) {
+    if (PID < NUM_TASKS) {
+        processes[PID].sleeping = 0;
+    }
+}
+
+// LOCAL FUNCTIONS
+/*
+internal_add
+    DESCRIPTION: links a timer into the slot for its expiry
+    INPUTS: timer - the timer, with expires set
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void internal_add(ktimer_t* timer) {
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - timer_jiffies;
+    ktimer_t* head;
+
+    if ((int32_t)delta < 0) {
+        // already due, run it on the next tick processed
+        head = &wheel[0][timer_jiffies & TIMER_SLOT_MASK];
+    } else if (delta < (1 << TIMER_SLOT_BITS)) {
+        head = &wheel[0][expires & TIMER_SLOT_MASK];
+    } else if (delta < (1 << (2 * TIMER_SLOT_BITS))) {
+        head = &wheel[1][(expires >> TIMER_SLOT_BITS) & TIMER_SLOT_MASK];
+    } else if (delta < (1 << (3 * TIMER_SLOT_BITS))) {
+        head = &wheel[2][(expires >> (2 * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK];
+    } else {
+        if (delta > TIMER_MAX_DELAY) {
+            expires = timer_jiffies + TIMER_MAX_DELAY;
+            timer->expires = expires;
+        }
+        head = &wheel[3][(expires >> (3 * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK];
+    }
+
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+    timer->pending = 1;
+    timers_pending++;
+}
+
+/*
+unlink
+    DESCRIPTION: takes a pending timer out of its slot
+    INPUTS: timer - the timer
+    OUTPUTS: none
+    RETURNS: none
+*/
+static void unlink(ktimer_t* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->pending = 0;
+    timers_pending--;
+}
+
+/*
+cascade
+    DESCRIPTION: re-adds every timer in a higher level slot, which moves them
+                 down now that they are close enough
+    INPUTS: level - level of the slot (1 and up)
+            index - slot number
+    OUTPUTS: none
+    RETURNS: index, so the caller only cascades further up when it wrapped too
+*/
+static uint32_t cascade(uint32_t level, uint32_t index) {
+    ktimer_t* head = &wheel[level][index];
+
+    while (head->next != head) {
+        ktimer_t* timer = head->next;
+        unlink(timer);
+        internal_add(timer);
+    }
+    return index;
+}
@@ -0,0 +1,41 @@
+// timer.h
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+
+#define TIMER_TICK_NS   1000000 // wheel resolution, 1 ms
+#define TIMER_LEVELS    4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS     (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+#define TIMER_MAX_DELAY ((1 << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1) // ~4.6 hours
+
+typedef void (*timer_func_t)(uint32_t arg);
+
+/*
+ * A kernel timer. Owned by the caller (embed it in whatever it is for), the
+ * wheel only links it in. func(arg) runs from the PIT interrupt with
+ * interrupts off, so it should only flip some state and must not switch tasks.
+ */
+typedef struct ktimer {
+    struct ktimer* next;
+    struct ktimer* prev;
+    uint32_t expires; // wheel tick the timer fires on
+    timer_func_t func;
+    uint32_t arg;
+    uint8_t pending;  // 1 while linked into the wheel
+} ktimer_t;
+
+// GLOBAL FUNCTIONS
+extern void timer_init(void);
+extern uint32_t timer_now(void);
+extern void timer_setup(ktimer_t* timer, timer_func_t func, uint32_t arg);
+extern void timer_add(ktimer_t* timer, uint32_t expires);
+extern void timer_cancel(ktimer_t* timer);
+extern void timer_run(void);
+extern int32_t timer_next_expiry(uint32_t* expiry);
+extern void timer_wakeup(uint32_t PID);
+
+#endif
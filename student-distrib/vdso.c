@@ -0,0 +1,37 @@
+// vdso.c
+// page of kernel data mapped read-only into every process, so time and tick
+// counts can be polled without trapping
+
+#include "vdso.h"
+#include "clock.h"
+#include "lib.h"
+
+// GLOBAL VARIABLES
+// padded to a whole page so nothing else in the kernel shares it
+static union {
+    vdso_data_t data;
+    uint8_t page[4096];
+} vdso_page __attribute__((aligned(4096)));
+
+vdso_data_t* const vdso = &vdso_page.data;
+
+// FUNCTION DECLARATIONS
+void vdso_init(void);
+
+// GLOBAL FUNCTIONS
+/*
+vdso_init
+    DESCRIPTION: fills in the clock calibration, the rest is kept up to date by
+                 the drivers that own it
+    INPUTS: none
+    OUTPUTS: none
+    RETURNS: none
+    NOTES: needs clock_init first
+*/
+void vdso_init(void) {
+    memset(&vdso_page, 0, sizeof(vdso_page));
+    vdso->tsc_khz = tsc_khz;
+    vdso->clock_mult = clock_mult;
+    vdso->clock_shift = CLOCK_SHIFT;
+    vdso->tsc_base = tsc_base;
+}
@@ -0,0 +1,41 @@
+// vdso.h
+
+#ifndef VDSO_H
+#define VDSO_H
+
+#include "types.h"
+#include "syscalls.h"
+
+#define VDSO_ADDR 0x09402000 // above the syscall ring, mapped read-only in every process
+
+/*
+ * Kernel data that processes can read without a system call. Every field is
+ * written with a single store, so a reader never sees a half-updated value
+ * (tsc_base is only written at boot).
+ *   rtc_count: RTC time in 1024ths of a second, only advancing while some
+ *       process has the RTC open at a nonzero rate
+ *   pit_ticks: PIT interrupts since boot (the PIT is tickless, so irregular)
+ *   tsc_khz, clock_mult, clock_shift, tsc_base: the monotonic clock is
+ *       ((rdtsc() - tsc_base) * clock_mult) >> clock_shift nanoseconds
+ *   cur_terminal: terminal on the screen
+ *   rtc_ticks: RTC ticks delivered to the RTC descriptors each PID opened
+ *   rtc_irq_tsc: low half of rdtsc() when the latest RTC interrupt came in
+ */
+typedef struct {
+    volatile uint32_t rtc_count;
+    volatile uint32_t pit_ticks;
+    uint32_t tsc_khz;
+    uint32_t clock_mult;
+    uint32_t clock_shift;
+    uint64_t tsc_base;
+    volatile uint32_t cur_terminal;
+    volatile uint32_t rtc_ticks[MAX_PROCESSES + 1];
+    volatile uint32_t rtc_irq_tsc;
+} vdso_data_t;
+
+extern vdso_data_t* const vdso;
+
+// GLOBAL FUNCTIONS
+extern void vdso_init(void);
+
+#endif
@@ -0,0 +1,92 @@
+// workqueue.c
+// deferred work (bottom halves) for the interrupt handlers
+// handlers grab whatever the hardware gives them, queue the rest here and return;
+// a kernel thread drains the queue with interrupts enabled
+
+#include "workqueue.h"
+#include "kthread.h"
+#include "lib.h"
+
+// GLOBAL VARIABLES
+static work_t work_queue[WORK_QUEUE_SIZE];
+static volatile uint32_t head = 0; // next free slot
+static volatile uint32_t tail = 0; // next item to run
+static int32_t worker_PID = -1;
+uint32_t work_dropped = 0; // items lost because the queue was full
+
+// FUNCTION DECLARATIONS
+int32_t workqueue_init(void);
+int32_t schedule_work(work_func_t func, uint32_t arg);
+static void worker(void);
+
+// GLOBAL FUNCTIONS
+/*
+ * workqueue_init
+ *   DESCRIPTION:  creates the kernel thread that runs deferred work
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 0 for success, -1 for fail
+ *   SIDE EFFECTS: takes a kernel thread slot
+ */
+int32_t workqueue_init(void) {
+    head = 0;
+    tail = 0;
+    worker_PID = kthread_create(worker);
+    return (worker_PID < 0) ? -1 : 0;
+}
+
+/*
+ * schedule_work
+ *   DESCRIPTION:  queues func(arg) to run later in the worker thread. Safe to call
+ *                 from interrupt handlers; the switch to the worker then happens
+ *                 when the handler returns.
+ *   INPUTS:       func - function to run
+ *                 arg - argument passed to func
+ *   OUTPUTS:      none
+ *   RETURN VALUE: 0 for success, -1 if the queue is full
+ *   SIDE EFFECTS: may context switch to the worker
+ */
+int32_t schedule_work(work_func_t func, uint32_t arg) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if ((head + 1) % WORK_QUEUE_SIZE == tail) {
+        work_dropped++;
+        restore_flags(flags);
+        return -1;
+    }
+    work_queue[head].func = func;
+    work_queue[head].arg = arg;
+    head = (head + 1) % WORK_QUEUE_SIZE;
+    restore_flags(flags);
+
+    kthread_wake(worker_PID);
+    return 0;
+}
+
+// LOCAL FUNCTIONS
+/*
+ * worker
+ *   DESCRIPTION:  body of the worker thread, runs queued work in order and
+ *                 sleeps when there is none
+ *   INPUTS:       none
+ *   OUTPUTS:      none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: whatever the queued work does
+ */
+static void worker(void) {
+    work_t work;
+
+    while (1) {
+        cli();
+        if (head == tail) {
+            kthread_sleep();
+            continue;
+        }
+        work = work_queue[tail];
+        tail = (tail + 1) % WORK_QUEUE_SIZE;
+        sti();
+
+        work.func(work.arg);
+    }
+}
@@ -0,0 +1,21 @@
+// workqueue.h
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "types.h"
+
+#define WORK_QUEUE_SIZE 64
+
+typedef void (*work_func_t)(uint32_t arg);
+
+typedef struct {
+    work_func_t func;
+    uint32_t arg;
+} work_t;
+
+// GLOBAL FUNCTIONS
+extern int32_t workqueue_init(void);
+extern int32_t schedule_work(work_func_t func, uint32_t arg);
+
+#endif
@@ -0,0 +1,104 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 32
+#define ITERATIONS 10000
+#define STACK_SIZE 4096
+
+/*
+ * Context switch cost. "ctxbench" bounces messages off a thread, which
+ * shares its page directory, and then off "ctxbench server", which has its
+ * own, so every switch there loads CR3. The gap between the two is what
+ * the address space change costs, mostly TLB refills after the flush.
+ */
+
+static uint8_t thread_stack[STACK_SIZE];
+
+static int32_t serve (void)
+{
+    ece391_ipc_msg_t msg;
+    int32_t sender;
+
+    while (1) {
+        if (-1 == (sender = ece391_receive (&msg)))
+	    return 3;
+	ece391_reply (sender, &msg);
+	if (0 == msg.len)
+	    return 0;
+    }
+}
+
+static void thread_serve (void* arg)
+{
+    serve ();
+}
+
+/* Average ns per switch talking to pid, 0 if it stopped answering */
+static uint32_t bounce (int32_t pid)
+{
+    ece391_ipc_msg_t msg;
+    uint32_t i, ns;
+    uint64_t start;
+
+    start = ece391_vdso_ns ();
+    for (i = 0; i < ITERATIONS; i++) {
+        msg.len = 4;
+	if (-1 == ece391_send (pid, &msg))
+	    return 0;
+    }
+    ns = (uint32_t)(ece391_vdso_ns () - start);
+
+    msg.len = 0;
+    ece391_send (pid, &msg);
+
+    /* a round trip is two switches */
+    return ns / (2 * ITERATIONS);
+}
+
+static void report (const char* what, uint32_t ns)
+{
+    uint8_t buf[BUFSIZE];
+
+    ece391_fdputs (1, (uint8_t*)what);
+    ece391_itoa (ns, buf, 10);
+    ece391_fdputs (1, buf);
+    ece391_fdputs (1, (uint8_t*)" ns per switch\n");
+}
+
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    int32_t pid;
+    uint32_t same, other;
+
+    if (0 == ece391_getargs (buf, BUFSIZE) &&
+        0 == ece391_strcmp (buf, (uint8_t*)"server"))
+        return serve ();
+
+    if (-1 == (pid = ece391_thread_create (thread_serve, 0, thread_stack, STACK_SIZE))) {
+        ece391_fdputs (1, (uint8_t*)"could not start thread\n");
+	return 2;
+    }
+    if (0 == (same = bounce (pid))) {
+        ece391_fdputs (1, (uint8_t*)"thread went away\n");
+	return 3;
+    }
+
+    if (-1 == (pid = ece391_spawn ((uint8_t*)"ctxbench server", -1, -1))) {
+        ece391_fdputs (1, (uint8_t*)"could not start server\n");
+	return 2;
+    }
+    other = bounce (pid);
+    ece391_wait (pid);
+    if (0 == other) {
+        ece391_fdputs (1, (uint8_t*)"server went away\n");
+	return 3;
+    }
+
+    report ("same address space:  ", same);
+    report ("other address space: ", other);
+    report ("CR3 load + refill:   ", other > same ? other - same : 0);
+    return 0;
+}
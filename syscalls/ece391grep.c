@@ -13,7 +13,9 @@ do_one_file (const char* s, const char* fname)
     uint8_t data[BUFSIZE+1];
 
     s_len = ece391_strlen ((uint8_t*)s);
-    if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
+    if ('-' == fname[0] && '\0' == fname[1])
+        fd = 0; /* standard input */
+    else if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
         ece391_fdputs (1, (uint8_t*)"file open failed\n");
         return -1;
     }
@@ -42,8 +44,10 @@ do_one_file (const char* s, const char* fname)
 	    for (check = line_start; check < line_end; check++) {
 		if (s[0] == data[check] && 
 		    0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
-		    ece391_fdputs (1, (uint8_t*)fname);
-		    ece391_fdputs (1, (uint8_t*)":");
+		    if (0 != fd) {
+		        ece391_fdputs (1, (uint8_t*)fname);
+		        ece391_fdputs (1, (uint8_t*)":");
+		    }
 		    ece391_fdputs (1, data + line_start);
 		    ece391_fdputs (1, (uint8_t*)"\n");
 		    break;
@@ -58,7 +62,7 @@ do_one_file (const char* s, const char* fname)
 	if (0 == cnt)
 	    break;
     }
-    if (-1 == ece391_close (fd)) {
+    if (0 != fd && -1 == ece391_close (fd)) {
         ece391_fdputs (1, (uint8_t*)"file close failed\n");
         return -1;
     }
@@ -76,6 +80,13 @@ int main ()
         return 3;
     }
 
+    /* "grep - pattern" searches standard input, e.g. "cat frame0.txt | grep - fish" */
+    if ('-' == search[0] && ' ' == search[1]) {
+        if (0 != do_one_file ((char*)search + 2, "-"))
+	    return 3;
+	return 0;
+    }
+
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
 	return 2;
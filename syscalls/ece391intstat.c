@@ -0,0 +1,46 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 33
+
+/*
+ * Prints every interrupt vector taken since boot, with how many times and
+ * how long its handler ran in total, in units of 1024 TSC cycles.
+ */
+
+static void put_num (uint32_t value)
+{
+    uint8_t buf[BUFSIZE];
+
+    ece391_itoa (value, buf, 10);
+    ece391_fdputs (1, buf);
+}
+
+int main ()
+{
+    ece391_int_stat_t stats[ECE391_NUM_INT_STATS];
+    uint8_t buf[BUFSIZE];
+    int32_t i, n;
+
+    if (-1 == (n = ece391_int_stats (stats, ECE391_NUM_INT_STATS))) {
+        ece391_fdputs (1, (uint8_t*)"could not read interrupt statistics\n");
+	return 2;
+    }
+
+    ece391_fdputs (1, (uint8_t*)"vector count kcycles\n");
+    for (i = 0; i < n; i++) {
+        if (0 == stats[i].count)
+	    continue;
+	ece391_fdputs (1, (uint8_t*)"0x");
+	ece391_itoa (i, buf, 16);
+	ece391_fdputs (1, buf);
+	ece391_fdputs (1, (uint8_t*)" ");
+	put_num (stats[i].count);
+	ece391_fdputs (1, (uint8_t*)" ");
+	put_num ((uint32_t)(stats[i].cycles >> 10));
+	ece391_fdputs (1, (uint8_t*)"\n");
+    }
+    return 0;
+}
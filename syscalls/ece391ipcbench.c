@@ -0,0 +1,69 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 32
+#define ITERATIONS 10000
+
+/*
+ * Ping-pong over send/receive/reply. "ipcbench" spawns "ipcbench server",
+ * bounces a counter off it and reports the average round trip.
+ */
+
+static int32_t serve (void)
+{
+    ece391_ipc_msg_t msg;
+    int32_t sender;
+
+    while (1) {
+        if (-1 == (sender = ece391_receive (&msg)))
+	    return 3;
+	if (0 == msg.len) {
+	    /* empty message: done */
+	    ece391_reply (sender, &msg);
+	    return 0;
+	}
+	(*(uint32_t*)msg.data)++;
+	ece391_reply (sender, &msg);
+    }
+}
+
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    ece391_ipc_msg_t msg;
+    int32_t pid;
+    uint32_t i, ns;
+    uint64_t start;
+
+    if (0 == ece391_getargs (buf, BUFSIZE) &&
+        0 == ece391_strcmp (buf, (uint8_t*)"server"))
+        return serve ();
+
+    if (-1 == (pid = ece391_spawn ((uint8_t*)"ipcbench server", -1, -1))) {
+        ece391_fdputs (1, (uint8_t*)"could not start server\n");
+	return 2;
+    }
+
+    start = ece391_vdso_ns ();
+    for (i = 0; i < ITERATIONS; i++) {
+        msg.len = 4;
+	*(uint32_t*)msg.data = i;
+	if (-1 == ece391_send (pid, &msg) || i + 1 != *(uint32_t*)msg.data) {
+	    ece391_fdputs (1, (uint8_t*)"bad reply\n");
+	    return 3;
+	}
+    }
+    ns = (uint32_t)(ece391_vdso_ns () - start);
+
+    msg.len = 0;
+    ece391_send (pid, &msg);
+    ece391_wait (pid);
+
+    ece391_fdputs (1, (uint8_t*)"round trip: ");
+    ece391_itoa (ns / ITERATIONS, buf, 10);
+    ece391_fdputs (1, buf);
+    ece391_fdputs (1, (uint8_t*)" ns\n");
+    return 0;
+}
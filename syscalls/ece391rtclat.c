@@ -0,0 +1,108 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 33
+#define RTC_IRQ 8
+#define RATE 1024
+#define SAMPLES 2048
+#define MAX_SAMPLE_NS 1000000 /* keeps the total in 32 bits */
+
+/*
+ * Measures how long after an RTC interrupt rtc_read returns, at 1024 Hz.
+ * The interrupt's arrival comes from the vDSO (rtc_irq_tsc), so each
+ * sample covers the handler, the bottom half waking us and the switch back
+ * to user space. Prints the result as a histogram next to the kernel's
+ * histogram of the RTC handler alone.
+ */
+
+static void put_num (uint32_t value)
+{
+    uint8_t buf[BUFSIZE];
+
+    ece391_itoa (value, buf, 10);
+    ece391_fdputs (1, buf);
+}
+
+static void put_histogram (const uint32_t* buckets)
+{
+    int32_t i;
+
+    for (i = 0; i < ECE391_LATENCY_BUCKETS; i++) {
+        if (0 == buckets[i])
+	    continue;
+	if (0 == i) {
+	    ece391_fdputs (1, (uint8_t*)"      < ");
+	    put_num (1 << ECE391_LATENCY_FIRST_SHIFT);
+	} else {
+	    ece391_fdputs (1, (uint8_t*)"  ");
+	    put_num (1 << (ECE391_LATENCY_FIRST_SHIFT - 1 + i));
+	    ece391_fdputs (1, (uint8_t*)(ECE391_LATENCY_BUCKETS - 1 == i ? " +" : " - "));
+	    if (ECE391_LATENCY_BUCKETS - 1 != i)
+	        put_num (1 << (ECE391_LATENCY_FIRST_SHIFT + i));
+	}
+	ece391_fdputs (1, (uint8_t*)" ns: ");
+	put_num (buckets[i]);
+	ece391_fdputs (1, (uint8_t*)"\n");
+    }
+}
+
+int main ()
+{
+    ece391_irq_latency_t kernel;
+    uint32_t buckets[ECE391_LATENCY_BUCKETS];
+    uint32_t i, b, lo, hi, ns, garbage;
+    uint32_t min = 0xFFFFFFFF, max = 0, total = 0;
+    int32_t rtc_fd, rate = RATE;
+
+    if (-1 == (rtc_fd = ece391_open ((uint8_t*)"rtc")) ||
+        -1 == ece391_write (rtc_fd, &rate, 4)) {
+        ece391_fdputs (1, (uint8_t*)"could not set up the rtc\n");
+	return 2;
+    }
+
+    for (i = 0; i < ECE391_LATENCY_BUCKETS; i++)
+        buckets[i] = 0;
+
+    /* the first read may return on a tick from before we asked */
+    ece391_read (rtc_fd, &garbage, 4);
+
+    for (i = 0; i < SAMPLES; i++) {
+        ece391_read (rtc_fd, &garbage, 4);
+	asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+	ns = (uint32_t)(((uint64_t)(lo - ece391_vdso->rtc_irq_tsc) *
+	                 ece391_vdso->clock_mult) >> ece391_vdso->clock_shift);
+	if (ns > MAX_SAMPLE_NS)
+	    ns = MAX_SAMPLE_NS;
+
+	for (b = 0; b < ECE391_LATENCY_BUCKETS - 1 &&
+	            (ns >> (ECE391_LATENCY_FIRST_SHIFT + b)); b++);
+	buckets[b]++;
+	total += ns;
+	if (ns < min)
+	    min = ns;
+	if (ns > max)
+	    max = ns;
+    }
+    ece391_close (rtc_fd);
+
+    ece391_fdputs (1, (uint8_t*)"rtc interrupt to rtc_read return, ns: min ");
+    put_num (min);
+    ece391_fdputs (1, (uint8_t*)" avg ");
+    put_num (total / SAMPLES);
+    ece391_fdputs (1, (uint8_t*)" max ");
+    put_num (max);
+    ece391_fdputs (1, (uint8_t*)"\n");
+    put_histogram (buckets);
+
+    if (0 == ece391_irq_latency (RTC_IRQ, &kernel)) {
+        ece391_fdputs (1, (uint8_t*)"rtc handler since boot: ");
+	put_num (kernel.count);
+	ece391_fdputs (1, (uint8_t*)" interrupts, max ");
+	put_num (kernel.max_ns);
+	ece391_fdputs (1, (uint8_t*)" ns\n");
+	put_histogram (kernel.buckets);
+    }
+    return 0;
+}
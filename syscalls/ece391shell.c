@@ -4,10 +4,78 @@
 #include "ece391syscall.h"
 
 #define BUFSIZE 1024
+#define MAXSTAGES 8
+
+/* 
+ * Runs "a | b | c": every stage is spawned with its stdout feeding the
+ * next stage's stdin through a pipe, then the shell waits for all of them.
+ * Returns the status of the last stage, or -1 if a stage could not start.
+ */
+int32_t
+run_pipeline (uint8_t* buf)
+{
+    uint8_t* stage[MAXSTAGES];
+    int32_t pid[MAXSTAGES];
+    int32_t fds[2];
+    int32_t n, i, end, in, rval, status;
+
+    n = 1;
+    stage[0] = buf;
+    for (i = 0; '\0' != buf[i]; i++) {
+        if ('|' == buf[i]) {
+	    if (MAXSTAGES == n)
+	        return -1;
+	    buf[i] = '\0';
+	    stage[n++] = buf + i + 1;
+	}
+    }
+    for (i = 0; i < n; i++) {
+        while (' ' == *stage[i])
+	    stage[i]++;
+	end = ece391_strlen (stage[i]);
+	while (end > 0 && ' ' == stage[i][end - 1])
+	    stage[i][--end] = '\0';
+	if (0 == end)
+	    return -1;
+    }
+
+    in = -1;
+    rval = 0;
+    for (i = 0; i < n; i++) {
+        fds[1] = -1;
+        if (i < n - 1 && -1 == ece391_pipe (fds)) {
+	    ece391_fdputs (1, (uint8_t*)"pipe failed\n");
+	    if (-1 != in)
+	        ece391_close (in);
+	    n = i;
+	    rval = -1;
+	    break;
+	}
+	/* the children hold their own ends, the shell lets go of its copies */
+	pid[i] = ece391_spawn (stage[i], in, fds[1]);
+	if (-1 != in)
+	    ece391_close (in);
+	if (-1 != fds[1]) {
+	    ece391_close (fds[1]);
+	    in = fds[0];
+	}
+	if (-1 == pid[i])
+	    rval = -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (-1 == pid[i])
+	    continue;
+	status = ece391_wait (pid[i]);
+	if (n - 1 == i && -1 != rval)
+	    rval = status;
+    }
+    return rval;
+}
 
 int main ()
 {
-    int32_t cnt, rval;
+    int32_t cnt, rval, i;
     uint8_t buf[BUFSIZE];
     ece391_fdputs (1, (uint8_t*)"Starting 391 Shell\n");
 
@@ -24,7 +92,11 @@ int main ()
 	    return 0;
 	if ('\0' == buf[0])
 	    continue;
-	rval = ece391_execute (buf);
+	for (i = 0; '\0' != buf[i] && '|' != buf[i]; i++);
+	if ('|' == buf[i])
+	    rval = run_pipeline (buf);
+	else
+	    rval = ece391_execute (buf);
 	if (-1 == rval)
 	    ece391_fdputs (1, (uint8_t*)"no such command\n");
 	else if (256 == rval)
@@ -102,3 +102,190 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+/* Monotonic nanoseconds since boot, computed from the vDSO page */
+uint64_t ece391_vdso_ns(void)
+{
+    uint32_t lo, hi;
+    uint64_t cycles;
+
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    cycles = (((uint64_t)hi << 32) | lo) - ece391_vdso->tsc_base;
+    lo = (uint32_t)cycles;
+    hi = (uint32_t)(cycles >> 32);
+
+    /* split the multiply so the 64-bit product can't overflow */
+    return (((uint64_t)lo * ece391_vdso->clock_mult) >> ece391_vdso->clock_shift) +
+           (((uint64_t)hi * ece391_vdso->clock_mult) << (32 - ece391_vdso->clock_shift));
+}
+
+/*
+ * Mutex in a word that starts out 0: 0 is unlocked, 1 locked, 2 locked with
+ * (possibly) somebody asleep on it. Locking and unlocking a free mutex never
+ * enters the kernel; only a contended lock sleeps in futex_wait and only an
+ * unlock that may have sleepers calls futex_wake.
+ */
+static uint32_t cmpxchg(volatile uint32_t* m, uint32_t old, uint32_t new)
+{
+    uint32_t prev;
+
+    asm volatile ("lock; cmpxchgl %2, %1"
+                  : "=a"(prev), "+m"(*m)
+                  : "r"(new), "0"(old)
+                  : "memory");
+    return prev;
+}
+
+static uint32_t xchg(volatile uint32_t* m, uint32_t new)
+{
+    asm volatile ("xchgl %0, %1"
+                  : "+r"(new), "+m"(*m)
+                  :
+                  : "memory");
+    return new;
+}
+
+void ece391_mutex_lock(volatile uint32_t* m)
+{
+    uint32_t c;
+
+    if (0 == (c = cmpxchg (m, 0, 1)))
+        return;
+    if (2 != c)
+        c = xchg (m, 2);
+    while (0 != c) {
+        ece391_futex_wait (m, 2);
+        c = xchg (m, 2);
+    }
+}
+
+void ece391_mutex_unlock(volatile uint32_t* m)
+{
+    if (2 == xchg (m, 0))
+        ece391_futex_wake (m, 1);
+}
+
+/* First code a new thread runs: fn and arg sit on its stack like arguments */
+static void thread_start(void (*fn)(void*), void* arg)
+{
+    fn (arg);
+    ece391_halt (0);
+}
+
+/* Runs fn(arg) in a new thread on the given stack, returns its pid or -1 */
+int32_t ece391_thread_create(void (*fn)(void*), void* arg, void* stack, uint32_t size)
+{
+    uint32_t* sp = (uint32_t*)(((uint32_t)stack + size) & ~3);
+
+    *--sp = (uint32_t)arg;
+    *--sp = (uint32_t)fn;
+    *--sp = 0; /* return address, thread_start never returns */
+    return ece391_clone ((void*)thread_start, sp);
+}
+
+/*
+ * Heap allocator on top of ece391_sbrk. Blocks of up to 2 KB come in power of
+ * two size classes from 16 bytes up; each class carves its blocks out of 4 KB
+ * chunks and keeps freed ones on its own list. Bigger blocks are whole pages
+ * and go on one first-fit list when freed. Every block starts with a header
+ * holding its size, so ece391_free knows where it goes.
+ */
+#define MALLOC_MIN_SHIFT 4
+#define MALLOC_CLASSES   8     /* 16 bytes to 2 KB */
+#define MALLOC_CHUNK     4096
+
+typedef union malloc_block {
+    struct {
+        uint32_t size;                  /* including this header */
+        union malloc_block* next;       /* while free */
+    } h;
+    uint64_t align;
+} malloc_block_t;
+
+static malloc_block_t* malloc_free[MALLOC_CLASSES];
+static malloc_block_t* malloc_big;
+static volatile uint32_t malloc_lock;
+
+/* Smallest class that fits "size" bytes with the header, -1 if none does */
+static int32_t malloc_class(uint32_t size)
+{
+    int32_t c;
+
+    for (c = 0; c < MALLOC_CLASSES; c++) {
+        if (size <= ((uint32_t)1 << (MALLOC_MIN_SHIFT + c)))
+            return c;
+    }
+    return -1;
+}
+
+/* Fills class c's list from a fresh chunk */
+static int32_t malloc_refill(int32_t c)
+{
+    uint32_t size = (uint32_t)1 << (MALLOC_MIN_SHIFT + c);
+    uint8_t* chunk;
+    uint32_t i;
+
+    if ((void*)-1 == (chunk = ece391_sbrk (MALLOC_CHUNK)))
+        return -1;
+    for (i = 0; i + size <= MALLOC_CHUNK; i += size) {
+        malloc_block_t* b = (malloc_block_t*)(chunk + i);
+        b->h.size = size;
+        b->h.next = malloc_free[c];
+        malloc_free[c] = b;
+    }
+    return 0;
+}
+
+void* ece391_malloc(uint32_t size)
+{
+    malloc_block_t* b;
+    malloc_block_t** link;
+    int32_t c;
+
+    if (0 == size || size > 0x7FFFFFFF - MALLOC_CHUNK)
+        return 0;
+    size += sizeof (malloc_block_t);
+
+    ece391_mutex_lock (&malloc_lock);
+    if (-1 != (c = malloc_class (size))) {
+        if (!malloc_free[c] && -1 == malloc_refill (c)) {
+            ece391_mutex_unlock (&malloc_lock);
+            return 0;
+        }
+        b = malloc_free[c];
+        malloc_free[c] = b->h.next;
+    } else {
+        size = (size + MALLOC_CHUNK - 1) & ~(MALLOC_CHUNK - 1);
+        for (link = &malloc_big; *link && (*link)->h.size < size; link = &(*link)->h.next);
+        if (*link) {
+            b = *link;
+            *link = b->h.next;
+        } else if ((void*)-1 != (b = ece391_sbrk (size))) {
+            b->h.size = size;
+        } else {
+            ece391_mutex_unlock (&malloc_lock);
+            return 0;
+        }
+    }
+    ece391_mutex_unlock (&malloc_lock);
+
+    return b + 1;
+}
+
+void ece391_free(void* ptr)
+{
+    malloc_block_t* b = (malloc_block_t*)ptr - 1;
+    int32_t c;
+
+    if (!ptr)
+        return;
+
+    ece391_mutex_lock (&malloc_lock);
+    if (-1 != (c = malloc_class (b->h.size))) {
+        b->h.next = malloc_free[c];
+        malloc_free[c] = b;
+    } else {
+        b->h.next = malloc_big;
+        malloc_big = b;
+    }
+    ece391_mutex_unlock (&malloc_lock);
+}
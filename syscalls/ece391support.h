@@ -8,6 +8,12 @@ extern int32_t ece391_strcmp(const uint8_t* s1, const uint8_t* s2);
 extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
+extern uint64_t ece391_vdso_ns(void);
+extern void ece391_mutex_lock(volatile uint32_t* m);
+extern void ece391_mutex_unlock(volatile uint32_t* m);
+extern int32_t ece391_thread_create(void (*fn)(void*), void* arg, void* stack, uint32_t size);
+extern void* ece391_malloc(uint32_t size);
+extern void ece391_free(void* ptr);
 
 #endif /* ECE391SUPPORT_H */
 
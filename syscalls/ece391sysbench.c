@@ -0,0 +1,80 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+#include "ece391sysnum.h"
+
+#define BUFSIZE 32
+#define ITERATIONS 10000
+
+/* close(-1) fails right after dispatch, so it measures just the way in and out */
+#define NULL_CALL SYS_CLOSE
+#define NULL_ARG  -1
+
+static inline uint32_t rdtsc_lo (void)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+static int32_t int80_call (int32_t num, int32_t arg)
+{
+    int32_t ret;
+    asm volatile ("int $0x80"
+                  : "=a"(ret)
+                  : "a"(num), "b"(arg), "c"(0), "d"(0)
+                  : "memory");
+    return ret;
+}
+
+static int32_t sysenter_call (int32_t num, int32_t arg)
+{
+    int32_t ret;
+    asm volatile ("pushl %%ebp\n\t"
+                  "pushl %%esi\n\t"
+                  "movl $1f, %%esi\n\t"
+                  "movl %%esp, %%ebp\n\t"
+                  "sysenter\n"
+                  "1:\n\t"
+                  "popl %%esi\n\t"
+                  "popl %%ebp"
+                  : "=a"(ret)
+                  : "a"(num), "b"(arg)
+                  : "ecx", "edx", "memory");
+    return ret;
+}
+
+static void report (const char* name, uint32_t cycles)
+{
+    uint8_t buf[BUFSIZE];
+
+    ece391_fdputs (1, (uint8_t*)name);
+    ece391_itoa (cycles / ITERATIONS, buf, 10);
+    ece391_fdputs (1, buf);
+    ece391_fdputs (1, (uint8_t*)" cycles/call\n");
+}
+
+int main ()
+{
+    uint32_t i, start, int80, sysenter;
+
+    start = rdtsc_lo ();
+    for (i = 0; i < ITERATIONS; i++)
+        int80_call (NULL_CALL, NULL_ARG);
+    int80 = rdtsc_lo () - start;
+    report ("int $0x80: ", int80);
+
+    if (!ece391_has_sysenter) {
+        ece391_fdputs (1, (uint8_t*)"sysenter: not supported\n");
+        return 0;
+    }
+
+    start = rdtsc_lo ();
+    for (i = 0; i < ITERATIONS; i++)
+        sysenter_call (NULL_CALL, NULL_ARG);
+    sysenter = rdtsc_lo () - start;
+    report ("sysenter:  ", sysenter);
+
+    return 0;
+}
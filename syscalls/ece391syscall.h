@@ -5,6 +5,9 @@
 
 /* All calls return >= 0 on success or -1 on failure. */
 
+/* Nonzero if the syscall stubs use sysenter instead of int $0x80. */
+extern uint8_t ece391_has_sysenter;
+
 /*  
  * Note that the system call for halt will have to make sure that only
  * the low byte of EBX (the status argument) is returned to the calling
@@ -22,6 +25,177 @@ extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 
+/* Monotonic time since boot, from the TSC. */
+#define ECE391_CLOCK_MONOTONIC 0
+
+typedef struct ece391_timespec {
+	uint32_t tv_sec;
+	uint32_t tv_nsec;
+} ece391_timespec_t;
+
+extern int32_t ece391_clock_gettime (int32_t clock_id, ece391_timespec_t* tp);
+extern int32_t ece391_nanosleep (const ece391_timespec_t* req);
+
+/*
+ * Batched system calls. Fill in entries at sq[sq_tail % ECE391_RING_ENTRIES],
+ * bump sq_tail, and ece391_ring_enter runs them all in one trap. Results come
+ * back in order at cq[cq_head % ECE391_RING_ENTRIES] up to cq_tail; bump cq_head
+ * once they have been read. Opcodes are the SYS_ numbers of read, write, open
+ * and close.
+ */
+#define ECE391_RING_ENTRIES 128
+
+typedef struct ece391_ring_sqe {
+	uint32_t opcode;
+	int32_t fd;
+	const void* buf;	/* filename for open */
+	int32_t nbytes;
+	uint32_t user_data;
+} ece391_ring_sqe_t;
+
+typedef struct ece391_ring_cqe {
+	uint32_t user_data;
+	int32_t result;
+} ece391_ring_cqe_t;
+
+typedef struct ece391_ring {
+	volatile uint32_t sq_head;
+	volatile uint32_t sq_tail;
+	volatile uint32_t cq_head;
+	volatile uint32_t cq_tail;
+	ece391_ring_sqe_t sq[ECE391_RING_ENTRIES];
+	ece391_ring_cqe_t cq[ECE391_RING_ENTRIES];
+} ece391_ring_t;
+
+extern int32_t ece391_ring_setup (ece391_ring_t** ring);
+extern int32_t ece391_ring_enter (void);
+
+/*
+ * Pipes and background children. ece391_pipe fills in fds[0] (read end) and
+ * fds[1] (write end). ece391_spawn starts a program next to the caller with
+ * fd_in/fd_out (or the terminal for -1) as its fds 0 and 1 and returns its
+ * pid; ece391_wait blocks until that child halts and returns its status.
+ */
+extern int32_t ece391_pipe (int32_t fds[2]);
+extern int32_t ece391_spawn (const uint8_t* command, int32_t fd_in, int32_t fd_out);
+extern int32_t ece391_wait (int32_t pid);
+
+/*
+ * Named shared memory. ece391_shm_create returns the id of the segment with
+ * that name, making a zeroed one of at least size bytes if there is none.
+ * Segments attach at any page-aligned address in the window below; every
+ * process that attaches one sees the same memory. A segment goes away when
+ * the last process detaches (halting detaches everything).
+ */
+#define ECE391_SHM_WINDOW 0x09800000
+#define ECE391_SHM_WINDOW_SIZE 0x00400000
+
+extern int32_t ece391_shm_create (const uint8_t* name, uint32_t size);
+extern int32_t ece391_shm_attach (int32_t id, void* addr);
+extern int32_t ece391_shm_detach (void* addr);
+
+/*
+ * ece391_futex_wait sleeps until another process calls ece391_futex_wake on
+ * the same word, unless the word no longer holds val (returns -1 right away).
+ * The word may be in shared memory. ece391_futex_wake returns how many
+ * waiters it woke. See ece391_mutex_lock for a lock built on these.
+ */
+extern int32_t ece391_futex_wait (volatile uint32_t* addr, uint32_t val);
+extern int32_t ece391_futex_wake (volatile uint32_t* addr, int32_t count);
+
+/*
+ * Synchronous messages. ece391_send delivers msg to pid and blocks until pid
+ * answers with ece391_reply; the reply overwrites msg. ece391_receive blocks
+ * for the next message and returns its sender (also in msg->pid).
+ */
+#define ECE391_IPC_MSG_SIZE 64
+
+typedef struct ece391_ipc_msg {
+	int32_t pid;
+	int32_t len;
+	uint8_t data[ECE391_IPC_MSG_SIZE];
+} ece391_ipc_msg_t;
+
+extern int32_t ece391_send (int32_t pid, ece391_ipc_msg_t* msg);
+extern int32_t ece391_receive (ece391_ipc_msg_t* msg);
+extern int32_t ece391_reply (int32_t pid, ece391_ipc_msg_t* msg);
+
+/*
+ * Threads. ece391_clone starts a task at entry with esp = stack that shares
+ * this program's memory and file descriptors and returns its pid. A thread
+ * ends with ece391_halt; halting the main thread ends every thread.
+ * ece391_thread_create (ece391support.h) is the friendlier way in.
+ */
+extern int32_t ece391_clone (void* entry, void* stack);
+
+/*
+ * Interrupt statistics, indexed by vector (0x20 + n for IRQ n, 0x30 for the
+ * local APIC timer): how often each was taken and the TSC cycles its handler
+ * ran for. ece391_int_stats fills in up to count entries and returns how
+ * many it did.
+ */
+#define ECE391_NUM_INT_STATS 0x31
+
+typedef struct ece391_int_stat {
+	uint32_t count;
+	uint32_t pad;
+	uint64_t cycles;
+} ece391_int_stat_t;
+
+extern int32_t ece391_int_stats (ece391_int_stat_t* buf, int32_t count);
+
+/*
+ * Per-IRQ histogram of the time from an interrupt reaching the kernel to its
+ * handler finishing. irq is 0-15, or 16 for the local APIC timer. Bucket 0
+ * counts samples under 256 ns, bucket i counts 2^(7+i) to 2^(8+i) ns and
+ * the last bucket everything longer.
+ */
+#define ECE391_LATENCY_IRQS        17
+#define ECE391_LATENCY_BUCKETS     16
+#define ECE391_LATENCY_FIRST_SHIFT 8
+
+typedef struct ece391_irq_latency {
+	uint32_t count;
+	uint32_t max_ns;
+	uint64_t total_ns;
+	uint32_t buckets[ECE391_LATENCY_BUCKETS];
+} ece391_irq_latency_t;
+
+extern int32_t ece391_irq_latency (int32_t irq, ece391_irq_latency_t* buf);
+
+/*
+ * Heap. It starts at the first 4 MB boundary past the program and ends at
+ * the break; ece391_brk sets the break, ece391_sbrk moves it by increment
+ * bytes and returns the old one ((void*)-1 on failure). Memory below the
+ * break reads as zero until it is written and only takes up a page once
+ * touched. ece391_malloc (ece391support.h) is the friendlier way in.
+ */
+extern int32_t ece391_brk (void* addr);
+extern void* ece391_sbrk (int32_t increment);
+
+/*
+ * Kernel data mapped read-only into every program, readable without a
+ * system call. The monotonic clock in nanoseconds is
+ * ((rdtsc - tsc_base) * clock_mult) >> clock_shift, see ece391_vdso_ns.
+ * rtc_count counts 1024ths of a second, but only while some program has the
+ * RTC set to a nonzero rate; rtc_ticks[pid] counts the RTC ticks delivered
+ * to the RTC descriptors a program opened. rtc_irq_tsc is the low
+ * half of the TSC when the latest RTC interrupt came in.
+ */
+typedef struct ece391_vdso {
+	volatile uint32_t rtc_count;
+	volatile uint32_t pit_ticks;
+	uint32_t tsc_khz;
+	uint32_t clock_mult;
+	uint32_t clock_shift;
+	uint64_t tsc_base;
+	volatile uint32_t cur_terminal;
+	volatile uint32_t rtc_ticks[7];
+	volatile uint32_t rtc_irq_tsc;
+} ece391_vdso_t;
+
+#define ece391_vdso ((const ece391_vdso_t*)0x09402000)
+
 enum signums {
 	DIV_ZERO = 0,
 	SEGFAULT,
@@ -11,5 +11,25 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_CLOCK_GETTIME 11
+#define SYS_NANOSLEEP  12
+#define SYS_RING_SETUP 13
+#define SYS_RING_ENTER 14
+#define SYS_PIPE       15
+#define SYS_SPAWN      16
+#define SYS_WAIT       17
+#define SYS_SHM_CREATE 18
+#define SYS_SHM_ATTACH 19
+#define SYS_SHM_DETACH 20
+#define SYS_FUTEX_WAIT 21
+#define SYS_FUTEX_WAKE 22
+#define SYS_SEND       23
+#define SYS_RECEIVE    24
+#define SYS_REPLY      25
+#define SYS_CLONE      26
+#define SYS_INT_STATS  27
+#define SYS_IRQ_LATENCY 28
+#define SYS_BRK        29
+#define SYS_SBRK       30
 
 #endif /* ECE391SYSNUM_H */